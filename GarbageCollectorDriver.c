@@ -1,14 +1,35 @@
+#include <stdio.h>
+#include <string.h>
+
 #include "mm.h"
 #include "memlib.h"
 
-#include <stdio.h>
-
 int verbose = 0;        /* global flag for verbose output */
-#define WORD_SIZE sizeof(void*)
-#define TAG_USED 1
 
 #define NUM_ROOTS 3
 
+/* Words of marking work done per incremental step */
+#define STEP_BUDGET 2
+
+/* Bytes of young blocks the nursery holds */
+#define NURSERY_SIZE 4096
+
+/* Garbage blocks allocated while the allocator collects on its own */
+#define CHURN_BLOCKS 100000
+#define CHURN_GC_PERCENT 100
+
+/* Length of the lists that are only reachable from the stack and .data */
+#define CHAIN_LENGTH 8
+
+/* Garbage blocks allocated while every allocation is sampled */
+#define SAMPLED_BLOCKS 1000
+
+/* Bytes of each, so that they span several sweep segments */
+#define SAMPLED_SIZE 128
+
+/* Threads that sweep a heap spanning many sweep segments */
+#define SWEEP_THREADS 4
+
 typedef struct obj_1 {
   void * ptr1;
   void * ptr2;
@@ -27,8 +48,22 @@ typedef struct obj_3 {
   void * ptr1;
 } obj_3;
 
+static void * alloc_obj(size_t size, int layout);
 static void initialize_blocks(void);
 static void validate_garbage_collect(void);
+static void validate_realloc_while_marking(void);
+static void validate_compaction(size_t heapBefore);
+static void validate_promotion(void);
+static void validate_minor_while_sweeping(void);
+static void validate_automatic_collection(void);
+static void scan_roots_from_stack(void);
+static obj_3 * alloc_chain(void);
+static void validate_root_scanning(obj_3 * stackChain);
+static void collect_sampled_garbage(void);
+static void reclaim_sampled_garbage(int compact);
+static double sampled_live_bytes(void);
+static void validate_parallel_sweep(size_t sweepsBefore);
+static int graph_is_intact(void);
 static int is_free(void * payloadPtr);
 
 static obj_1 * block1;
@@ -44,6 +79,15 @@ static obj_1 * block10;
 
 void * roots[NUM_ROOTS];
 
+/* Reachable only because .data and .bss are scanned */
+static obj_3 * dataChain;
+
+/* When set, blocks are allocated with their pointer layouts */
+static int precise = 0;
+static int layout_1;
+static int layout_2;
+static int layout_3;
+
 int main() {
     /* Initialize the simulated memory system in memlib.c */
     /* Call the mm package's init function */
@@ -60,16 +104,166 @@ int main() {
     mm_garbage_collect(roots, NUM_ROOTS);
     validate_garbage_collect();
 
+    /* Run the same graph through an incremental cycle of small steps */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    initialize_blocks();
+    mm_gc_start(roots, NUM_ROOTS);
+    while (!mm_gc_step(STEP_BUDGET))
+      ;
+    validate_garbage_collect();
+
+    /* Move a block while marking, leaving its copy the only path to a child */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    validate_realloc_while_marking();
+
+    /* Collect a graph of typed blocks, scanning only their pointer slots */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    layout_1 = mm_gc_register_layout(sizeof(obj_1),
+        GC_POINTER_SLOT(obj_1, ptr1) | GC_POINTER_SLOT(obj_1, ptr2) | GC_POINTER_SLOT(obj_1, ptr3));
+    layout_2 = mm_gc_register_layout(sizeof(obj_2),
+        GC_POINTER_SLOT(obj_2, ptr1) | GC_POINTER_SLOT(obj_2, ptr2));
+    layout_3 = mm_gc_register_layout(sizeof(obj_3), GC_POINTER_SLOT(obj_3, ptr1));
+
+    precise = 1;
+    initialize_blocks();
+    mm_garbage_collect(roots, NUM_ROOTS);
+    validate_garbage_collect();
+
+    /* Compact the typed graph, which has to move the roots' blocks */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    initialize_blocks();
+    for (int i = 0; i < NUM_ROOTS; i++)
+      mm_gc_register_root(&roots[i]);
+    size_t heapBefore = mem_heapsize();
+    mm_gc_compact();
+    validate_compaction(heapBefore);
+
+    /* Bump the typed graph in a nursery and promote its survivors */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    mm_gc_enable_nursery(NURSERY_SIZE);
+    initialize_blocks();
+    for (int i = 0; i < NUM_ROOTS; i++)
+      mm_gc_register_root(&roots[i]);
+    mm_gc_minor();
+    validate_promotion();
+
+    /* Promote out of a dead old block the lazy sweep has not reached yet */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    validate_minor_while_sweeping();
+
+    /* Churn through garbage and let the allocator decide when to collect */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    initialize_blocks();
+    for (int i = 0; i < NUM_ROOTS; i++)
+      mm_gc_register_root(&roots[i]);
+    mm_gc_set_percent(CHURN_GC_PERCENT);
+    for (int i = 0; i < CHURN_BLOCKS; i++)
+      memset(mm_malloc(sizeof(obj_1)), 0, sizeof(obj_1));
+    mm_gc_set_percent(GC_PERCENT_OFF);
+    validate_automatic_collection();
+
+    /* Keep blocks alive from the stack and .bss without passing roots */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    int stackBase;
+    mm_gc_set_stack_base(&stackBase);
+    scan_roots_from_stack();
+    mm_gc_set_stack_base(NULL);
+
+    /* The heap sampler's own tables must not keep its samples alive */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    mm_gc_set_stack_base(&stackBase);
+    mm_sample_heap(1);
+    collect_sampled_garbage();
+    mm_sample_heap(0);
+    mm_gc_set_stack_base(NULL);
+
+    /* Garbage the collector reclaims without mm_free must leave the profile */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    reclaim_sampled_garbage(1);
+    reclaim_sampled_garbage(0);
+
+    /* Sweep a heap of many segments with several threads */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+            printf("Error in mm_init\n");
+            return -1;
+    }
+
+    initialize_blocks();
+    for (int i = 0; i < CHURN_BLOCKS; i++)
+      mm_malloc((i % 7 + 1) * sizeof(obj_3));
+    size_t sweepsBefore = mm_gc_parallel_sweeps();
+    mm_gc_set_sweep_threads(SWEEP_THREADS);
+    mm_garbage_collect(roots, NUM_ROOTS);
+    mm_gc_set_sweep_threads(1);
+    validate_parallel_sweep(sweepsBefore);
+
     /*Free the remaining memory*/
     mem_deinit();
     return 0;
 }
 
+static void * alloc_obj(size_t size, int layout) {
+  if (precise)
+    return mm_malloc_typed(size, layout);
+  return mm_malloc(size);
+}
+
 static void initialize_blocks(void) {
   // Reachable fork
-  block1 = mm_malloc(sizeof(obj_1));
-  block2 = mm_malloc(sizeof(obj_2));
-  block3 = mm_malloc(sizeof(obj_3));
+  block1 = alloc_obj(sizeof(obj_1), layout_1);
+  block2 = alloc_obj(sizeof(obj_2), layout_2);
+  block3 = alloc_obj(sizeof(obj_3), layout_3);
 
   block1->ptr1 = block2;
   block1->ptr2 = block3;
@@ -86,31 +280,36 @@ static void initialize_blocks(void) {
   roots[0] = (void *) block1;
 
   // single reachable block
-  block4 = mm_malloc(sizeof(obj_3));
+  block4 = alloc_obj(sizeof(obj_3), layout_3);
 
   block4->ptr1 = NULL;
 
   roots[1] = (void *) block4;
 
   // This makes an unreachable loop
-  block7 = mm_malloc(sizeof(obj_3));
-  block8 = mm_malloc(sizeof(obj_3));
-  block9 = mm_malloc(sizeof(obj_3));
+  block7 = alloc_obj(sizeof(obj_3), layout_3);
+  block8 = alloc_obj(sizeof(obj_3), layout_3);
+  block9 = alloc_obj(sizeof(obj_3), layout_3);
 
   block7->ptr1 = block8;
   block8->ptr1 = block9;
   block9->ptr1 = block7;
 
   // Unreachable self-pointing block
-  block10 = mm_malloc(sizeof(obj_1));
+  block10 = alloc_obj(sizeof(obj_1), layout_1);
 
   block10->ptr1 = NULL;
   block10->ptr2 = block10;
   block10->ptr3 = NULL;
 
+  // A double whose bits happen to address block7 only keeps it alive
+  // when every word is scanned, so plant it in the precise run only
+  if (precise)
+    memcpy(&block2->d, &block7, sizeof(block7));
+
   // This is just a chain of two that are reachable
-  block5 = mm_malloc(sizeof(obj_2));
-  block6 = mm_malloc(sizeof(obj_1));
+  block5 = alloc_obj(sizeof(obj_2), layout_2);
+  block6 = alloc_obj(sizeof(obj_1), layout_1);
 
   block5->a = 1393294;
   block5->ptr1 = (void *) 333;
@@ -146,8 +345,289 @@ static void validate_garbage_collect(void) {
   }
 }
 
+static void validate_compaction(size_t heapBefore) {
+  int wasError = !graph_is_intact();
+
+  if (mem_heapsize() >= heapBefore) {
+    printf("ERROR: Compaction did not shrink the heap\n");
+    wasError = 1;
+  }
+
+  if (!wasError) {
+    printf("Success! The compacting collector passed all of the tests\n");
+  }
+}
+
+static void validate_promotion(void) {
+  int wasError = !graph_is_intact();
+
+  if (roots[0] == block1 || roots[1] == block4 || roots[2] == block5) {
+    printf("ERROR: A root still points into the nursery\n");
+    wasError = 1;
+  }
+
+  if (!wasError) {
+    printf("Success! The generational collector passed all of the tests\n");
+  }
+}
+
+static void validate_minor_while_sweeping(void) {
+  // the dead block is old, and its card is dirtied by a young pointer
+  obj_3 * dead = mm_malloc_typed(sizeof(obj_3), layout_3);
+  mm_gc_enable_nursery(NURSERY_SIZE);
+  obj_3 * young = mm_malloc_typed(sizeof(obj_3), layout_3);
+  young->ptr1 = (void *) 4242;
+  mm_gc_write_barrier(dead, &dead->ptr1, young);
+  int wasError = 0;
+
+  // finish marking without sweeping a single block
+  mm_gc_start(NULL, 0);
+  mm_gc_step(0);
+
+  // promoting the young block must not sweep the block being forwarded
+  mm_gc_minor();
+  obj_3 * copy = dead->ptr1;
+  if (is_free(dead) || copy == dead || copy->ptr1 != (void *) 4242) {
+    printf("ERROR: A minor collection swept the block it was forwarding\n");
+    wasError = 1;
+  }
+
+  while (!mm_gc_step(STEP_BUDGET))
+    ;
+  if (!is_free(dead)) {
+    printf("ERROR: The sweep did not free the dead block after the minor collection\n");
+    wasError = 1;
+  }
+
+  if (!wasError) {
+    printf("Success! The collector promoted out of an unswept block\n");
+  }
+}
+
+static void validate_automatic_collection(void) {
+  int wasError = !graph_is_intact();
+
+  if (mem_heapsize() >= CHURN_BLOCKS * sizeof(obj_1) / 2) {
+    printf("ERROR: The heap grew as if garbage was never collected\n");
+    wasError = 1;
+  }
+
+  if (!wasError) {
+    printf("Success! The automatic collector passed all of the tests\n");
+  }
+}
+
+static void scan_roots_from_stack(void) {
+  // called from main so this frame lies between the stack base and the collector
+  obj_3 * stackChain = alloc_chain();
+  dataChain = alloc_chain();
+  for (int i = 0; i < CHURN_BLOCKS / 10; i++)
+    mm_malloc(sizeof(obj_1));
+  mm_garbage_collect(NULL, 0);
+  validate_root_scanning(stackChain);
+}
+
+static void collect_sampled_garbage(void) {
+  // whole payloads are cleared, or stale pointers left in the reused heap
+  // by earlier tests would chain the garbage together
+  for (int i = 0; i < SAMPLED_BLOCKS; i++)
+    memset(mm_malloc(FREE_INFO_SIZE), 0, FREE_INFO_SIZE);
+  mm_garbage_collect(NULL, 0);
+
+  // a stray word on the stack may pin a few, but not half of them
+  size_t freed = 0;
+  for (Block * block = first_block(); block != NULL; block = next_block(block))
+    if (block->info.size <= 0)
+      freed += -block->info.size;
+  if (freed < SAMPLED_BLOCKS / 2 * FREE_INFO_SIZE) {
+    printf("ERROR: Sampled garbage was kept alive by the sampler\n");
+  } else {
+    printf("Success! The collector freed sampled garbage\n");
+  }
+}
+
+static void reclaim_sampled_garbage(int compact) {
+  int wasError = 0;
+
+  mm_sample_heap(1);
+  for (int i = 0; i < SAMPLED_BLOCKS; i++)
+    memset(mm_malloc(SAMPLED_SIZE), 0, SAMPLED_SIZE);
+
+  if (compact) {
+    mm_gc_compact();
+  } else {
+    size_t sweepsBefore = mm_gc_parallel_sweeps();
+    mm_gc_set_sweep_threads(SWEEP_THREADS);
+    mm_garbage_collect(NULL, 0);
+    mm_gc_set_sweep_threads(1);
+    if (mm_gc_parallel_sweeps() != sweepsBefore + 1) {
+      printf("ERROR: The sampled garbage was not swept in parallel\n");
+      wasError = 1;
+    }
+  }
+
+  if (sampled_live_bytes() >= SAMPLED_SIZE) {
+    printf("ERROR: The profile still counts sampled garbage as live\n");
+    wasError = 1;
+  }
+  mm_sample_heap(0);
+
+  if (!wasError) {
+    printf("Success! The %s took sampled garbage out of the profile\n",
+           compact ? "compaction" : "parallel sweep");
+  }
+}
+
+static double sampled_live_bytes(void) {
+  static HeapSite sites[HEAP_SAMPLE_SITES];
+  int count = mm_heap_sites(sites, HEAP_SAMPLE_SITES);
+  double bytes = 0;
+
+  for (int i = 0; i < count; i++)
+    bytes += sites[i].live_bytes;
+  return bytes;
+}
+
+static obj_3 * alloc_chain(void) {
+  obj_3 * head = NULL;
+  for (int i = 0; i < CHAIN_LENGTH; i++) {
+    obj_3 * node = mm_malloc(sizeof(obj_3));
+    node->ptr1 = head;
+    head = node;
+  }
+  return head;
+}
+
+static void validate_root_scanning(obj_3 * stackChain) {
+  int wasError = 0;
+  int length = 0;
+
+  for (obj_3 * node = stackChain; node != NULL; node = node->ptr1, length++)
+    wasError |= is_free(node);
+  for (obj_3 * node = dataChain; node != NULL; node = node->ptr1, length++)
+    wasError |= is_free(node);
+
+  if (wasError || length != 2 * CHAIN_LENGTH) {
+    printf("ERROR: A block reachable from the stack or .data was freed!\n");
+    wasError = 1;
+  }
+
+  size_t freed = 0;
+  for (Block * block = first_block(); block != NULL; block = next_block(block))
+    if (block->info.size <= 0)
+      freed += -block->info.size;
+  if (freed < CHURN_BLOCKS / 20 * sizeof(obj_1)) {
+    printf("ERROR: The garbage next to the scanned roots was never freed\n");
+    wasError = 1;
+  }
+
+  if (!wasError) {
+    printf("Success! The root-scanning collector passed all of the tests\n");
+  }
+}
+
+static void validate_realloc_while_marking(void) {
+  void * hole = mm_malloc(8 * sizeof(obj_1));
+  obj_1 * parent = mm_malloc(sizeof(obj_1));
+  obj_3 * child = mm_malloc(sizeof(obj_3));
+  int wasError = 0;
+
+  // a fit on the free list keeps mm_malloc from marking a slice first
+  mm_free(hole);
+
+  parent->ptr1 = child;
+  parent->ptr2 = NULL;
+  parent->ptr3 = NULL;
+  child->ptr1 = NULL;
+  roots[0] = parent;
+  roots[1] = NULL;
+  roots[2] = NULL;
+
+  // the child is allocated behind the parent, so growing it moves it
+  // into the hole before the parent is scanned
+  mm_gc_start(roots, NUM_ROOTS);
+  roots[0] = mm_realloc(parent, 8 * sizeof(obj_1));
+  while (!mm_gc_step(STEP_BUDGET))
+    ;
+
+  if (roots[0] == parent) {
+    printf("ERROR: The reallocated block did not move\n");
+    wasError = 1;
+  }
+  if (gc_find_block(child) == NULL) {
+    printf("ERROR: A block reachable only from a moved copy was freed\n");
+    wasError = 1;
+  }
+
+  if (!wasError) {
+    printf("Success! The collector survived a realloc while marking\n");
+  }
+}
+
+static void validate_parallel_sweep(size_t sweepsBefore) {
+  int wasError = !graph_is_intact();
+  Block * prev = NULL;
+  int prevFree = 0;
+
+  // a full collection must have taken the segmented path
+  if (mm_gc_parallel_sweeps() != sweepsBefore + 1) {
+    printf("ERROR: The collection did not sweep in parallel\n");
+    wasError = 1;
+  }
+
+  // runs of garbage must come out merged, even across segments
+  for (Block * block = first_block(); block != NULL; block = next_block(block)) {
+    if (block->info.prev != prev || (prevFree && block->info.size <= 0)) {
+      printf("ERROR: The parallel sweep left the heap inconsistent\n");
+      wasError = 1;
+      break;
+    }
+    prevFree = block->info.size <= 0;
+    prev = block;
+  }
+
+  // the freed garbage must be on the free list to be reused
+  size_t heapBefore = mem_heapsize();
+  for (int i = 0; i < CHURN_BLOCKS / 2; i++)
+    mm_malloc(sizeof(obj_3));
+  if (mem_heapsize() != heapBefore) {
+    printf("ERROR: The blocks freed by the parallel sweep were not reused\n");
+    wasError = 1;
+  }
+
+  if (!wasError) {
+    printf("Success! The parallel sweep passed all of the tests\n");
+  }
+}
+
+static int graph_is_intact(void) {
+  // the reachable graph must survive being moved with its data intact
+  obj_1 * b1 = roots[0];
+  obj_2 * b2 = b1->ptr1;
+  obj_3 * b3 = b1->ptr2;
+  obj_3 * b4 = roots[1];
+  obj_2 * b5 = roots[2];
+  obj_1 * b6 = b5->ptr2;
+  int wasError = 0;
+
+  if (is_free(b1) || is_free(b2) || is_free(b3)
+      || is_free(b4) || is_free(b5) || is_free(b6)) {
+    printf("ERROR: A block that was reachable was freed while moving!\n");
+    wasError = 1;
+  }
+
+  if (b1->ptr3 != (void *) 1 || b2->a != 1 || b2->b != 999999999
+      || b3->ptr1 != NULL || b4->ptr1 != NULL || b5->a != 1393294
+      || b5->ptr1 != (void *) 333 || b6->ptr2 != (void *) 7777) {
+    printf("ERROR: Moving did not preserve the data of a block\n");
+    wasError = 1;
+  }
+
+  return !wasError;
+}
+
 static int is_free(void * payloadPtr) {
-  size_t sizeAndTags = *((size_t*) ( ((char *) payloadPtr) - WORD_SIZE));
-  return !(sizeAndTags & TAG_USED);
+  Block * block = (Block *) UNSCALED_POINTER_SUB(payloadPtr, INFO_SIZE);
+  return block->info.size <= 0;
 }
 
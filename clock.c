@@ -21,16 +21,17 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
  *******************************************************/
 
 
 /* $begin x86cyclecounter */
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+/* Initialize the cycle counter, one per thread so that threads can
+   time themselves at once */
+static __thread unsigned cyc_hi = 0;
+static __thread unsigned cyc_lo = 0;
 
 
 /* Set *hi and *lo to the high and low order bits  of the cycle counter.  
@@ -32,6 +32,13 @@
   "binary-bal.rep",\
   "binary2-bal.rep"
 
+/*
+ * The GC workload traces that mdriver-gc replays by default
+ */
+#define DEFAULT_GC_TRACEFILES \
+  "gc-list-bal.rep",\
+  "gc-tree-bal.rep"
+
 /*
  * This constant gives the estimated performance of the libc malloc
  * package using our traces on some reference system, typically the
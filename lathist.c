@@ -0,0 +1,72 @@
+/*
+ * lathist.c - Log-linear latency histograms
+ */
+#include <string.h>
+#include "lathist.h"
+
+#define SUB_BUCKETS (1 << LATHIST_SUB_BITS)
+
+/*
+ * bucket_of - the bucket that holds value. A value with its top bit at
+ *     position msb lands in row msb - LATHIST_SUB_BITS + 1, at the
+ *     column given by the LATHIST_SUB_BITS bits below the top one.
+ */
+static int bucket_of(uint64_t value) {
+    int msb;
+
+    if (value < SUB_BUCKETS)
+        return (int)value;
+    msb = 63 - __builtin_clzll(value);
+    return ((msb - LATHIST_SUB_BITS + 1) << LATHIST_SUB_BITS) +
+        (int)((value >> (msb - LATHIST_SUB_BITS)) - SUB_BUCKETS);
+}
+
+/*
+ * bucket_top - the largest value that lands in bucket
+ */
+static uint64_t bucket_top(int bucket) {
+    int row = bucket >> LATHIST_SUB_BITS;
+    uint64_t column = (bucket & (SUB_BUCKETS - 1)) + SUB_BUCKETS;
+
+    if (row == 0)
+        return (uint64_t)bucket;
+    return ((column + 1) << (row - 1)) - 1;
+}
+
+void lathist_reset(lathist_t *hist) {
+    memset(hist, 0, sizeof(lathist_t));
+}
+
+void lathist_record(lathist_t *hist, uint64_t value) {
+    hist->buckets[bucket_of(value)]++;
+    hist->count++;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+void lathist_merge(lathist_t *dst, lathist_t *src) {
+    int i;
+
+    for (i = 0; i < LATHIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t lathist_percentile(lathist_t *hist, double p) {
+    uint64_t rank, seen = 0;
+    int i;
+
+    if (hist->count == 0)
+        return 0;
+    rank = (uint64_t)(p * hist->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (i = 0; i < LATHIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+            return (bucket_top(i) < hist->max) ? bucket_top(i) : hist->max;
+    }
+    return hist->max;
+}
@@ -0,0 +1,31 @@
+/*
+ * lathist.h - Log-linear latency histograms
+ *
+ * Values below 2^LATHIST_SUB_BITS get a bucket each. Above that, every
+ * power of two is split into 2^LATHIST_SUB_BITS equal buckets, so any
+ * recorded value is reported to within about 3%, with a fixed table
+ * and no allocation.
+ */
+#include <stdint.h>
+
+#define LATHIST_SUB_BITS 5
+#define LATHIST_BUCKETS  ((65 - LATHIST_SUB_BITS) << LATHIST_SUB_BITS)
+
+typedef struct {
+    uint64_t count;                     /* values recorded */
+    uint64_t max;                       /* the largest of them, exactly */
+    uint64_t buckets[LATHIST_BUCKETS];
+} lathist_t;
+
+/* Forget every recorded value */
+void lathist_reset(lathist_t *hist);
+
+/* Record one value */
+void lathist_record(lathist_t *hist, uint64_t value);
+
+/* Add every value recorded in src to dst */
+void lathist_merge(lathist_t *dst, lathist_t *src);
+
+/* The value that fraction p (0 to 1) of the recorded values are at or
+   below, rounded up to the top of its bucket */
+uint64_t lathist_percentile(lathist_t *hist, double p);
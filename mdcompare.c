@@ -0,0 +1,279 @@
+/*
+ * mdcompare.c - Flag significant changes between two mdriver result files
+ *
+ * Usage: mdcompare [-h] [-t <pct>] <base.csv> <new.csv>
+ *
+ * Both files are the CSV results of mdriver -n <runs> -o <file>.csv. For
+ * every allocator, trace and metric in both, mdcompare computes a 95%
+ * confidence interval for the change in the mean with Welch's t-test. A
+ * change is significant when the interval excludes zero and the change
+ * is at least the threshold (1% by default). Only util counts higher as
+ * better; time, latency and hardware events count lower as better.
+ * Metrics measured once on either side can only be compared when they
+ * do not vary, as util does not.
+ *
+ * A trace that is no longer valid, or a metric of the base file that the
+ * new file lacks, is a regression whatever the threshold, since an
+ * invalid trace is not measured at all.
+ *
+ * Exits with status 1 if anything regressed, so it can gate changes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <getopt.h>
+
+#define MAXLINE 1024 /* max string size */
+#define MAXKEY  256  /* max length of allocator/trace/metric */
+
+/******************************
+ * The key compound data types
+ *****************************/
+
+/* One row of a results file */
+typedef struct {
+    char key[MAXKEY];  /* allocator/trace/metric */
+    double value;
+} row_t;
+
+/* The rows of one results file, sorted by key */
+typedef struct {
+    row_t *rows;
+    int num_rows;
+} results_t;
+
+/* The samples of one metric in one file */
+typedef struct {
+    int n;
+    double mean;
+    double var;        /* sample variance, 0 if n < 2 */
+} summary_t;
+
+/*********************
+ * Function prototypes
+ *********************/
+
+static void read_results(char *path, results_t *results);
+static int cmp_row(const void *a, const void *b);
+static int summarize(results_t *results, int start, summary_t *summary);
+static double t_quantile(double df);
+static void usage(void);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv) {
+    results_t base, new;
+    summary_t b, n;
+    double threshold = 1.0;
+    int i, j, cmp;
+    int compared = 0, regressed = 0, improved = 0;
+    char c;
+
+    while ((c = getopt(argc, argv, "ht:")) != EOF) {
+        switch (c) {
+        case 't': /* Smallest change worth flagging, in percent */
+            threshold = atof(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+        exit(1);
+    }
+
+    read_results(argv[optind], &base);
+    read_results(argv[optind + 1], &new);
+
+    printf("%-40s%6s%14s%14s%9s%9s  %s\n",
+           "allocator/trace/metric", "runs", "base", "new", "change", "+/-", "");
+
+    /* Walk both sorted files together, one metric at a time */
+    for (i = 0, j = 0; i < base.num_rows; ) {
+        double diff, half, pct, df, a, v;
+        int higher_better, worse;
+        char *key, *metric, *verdict;
+
+        cmp = (j < new.num_rows) ? strcmp(base.rows[i].key, new.rows[j].key) : -1;
+        if (cmp < 0) {
+            /* Measured before but not now, as when the trace broke */
+            key = base.rows[i].key;
+            i = summarize(&base, i, &b);
+            printf("%-40s%3d/%-2d%14.6g%14s%9s%9s  %s\n",
+                   key, b.n, 0, b.mean, "-", "-", "-", "MISSING");
+            regressed++;
+            continue;
+        }
+        if (cmp > 0) {
+            j = summarize(&new, j, &n);
+            continue;
+        }
+
+        key = base.rows[i].key;
+        i = summarize(&base, i, &b);
+        j = summarize(&new, j, &n);
+        compared++;
+
+        metric = strrchr(key, '/') + 1;
+        higher_better = strcmp(metric, "util") == 0 || strcmp(metric, "valid") == 0;
+        diff = n.mean - b.mean;
+        pct = (b.mean != 0) ? 100 * diff / fabs(b.mean) : 0;
+
+        /* A trace that broke regressed, however small the threshold */
+        if (strcmp(metric, "valid") == 0) {
+            verdict = (diff < 0) ? "REGRESSED" : (diff > 0) ? "improved" : "";
+            regressed += diff < 0;
+            improved += diff > 0;
+            printf("%-40s%3d/%-2d%14.6g%14.6g%8.1f%%%9s  %s\n",
+                   key, b.n, n.n, b.mean, n.mean, pct, "-", verdict);
+            continue;
+        }
+
+        /* Welch's interval, or an exact one if neither side varies */
+        a = b.var / b.n;
+        v = n.var / n.n;
+        if (a + v == 0)
+            half = 0;
+        else if (b.n < 2 || n.n < 2) {
+            printf("%-40s%3d/%-2d%14.6g%14.6g%8.1f%%%9s  %s\n",
+                   key, b.n, n.n, b.mean, n.mean, pct, "-", "too few runs");
+            continue;
+        }
+        else {
+            df = (a + v) * (a + v) / (a * a / (b.n - 1) + v * v / (n.n - 1));
+            half = t_quantile(df) * sqrt(a + v);
+        }
+
+        worse = higher_better ? (diff < 0) : (diff > 0);
+        verdict = "";
+        if (fabs(diff) > half && fabs(pct) >= threshold) {
+            verdict = worse ? "REGRESSED" : "improved";
+            if (worse)
+                regressed++;
+            else
+                improved++;
+        }
+        printf("%-40s%3d/%-2d%14.6g%14.6g%8.1f%%%8.1f%%  %s\n",
+               key, b.n, n.n, b.mean, n.mean, pct,
+               (b.mean != 0) ? 100 * half / fabs(b.mean) : 0, verdict);
+    }
+
+    printf("\n%d metrics compared: %d regressed, %d improved\n",
+           compared, regressed, improved);
+    exit(regressed > 0);
+}
+
+/*
+ * read_results - read a CSV results file and sort its rows by key
+ */
+static void read_results(char *path, results_t *results) {
+    FILE *fp;
+    char line[MAXLINE], alloc[MAXLINE], trace[MAXLINE], metric[MAXLINE];
+    int run;
+    double value;
+    row_t *row;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        unix_error(path);
+    results->rows = NULL;
+    results->num_rows = 0;
+
+    while (fgets(line, MAXLINE, fp) != NULL) {
+        if (sscanf(line, "%1023[^,],%1023[^,],%1023[^,],%d,%lf",
+                   alloc, trace, metric, &run, &value) != 5)
+            continue; /* the header */
+        results->rows = realloc(results->rows, (results->num_rows + 1) * sizeof(row_t));
+        if (results->rows == NULL)
+            app_error("Out of memory");
+        row = &results->rows[results->num_rows++];
+        if (snprintf(row->key, MAXKEY, "%s/%s/%s", alloc, trace, metric) >= MAXKEY)
+            app_error("A trace or metric name is too long");
+        row->value = value;
+    }
+    fclose(fp);
+
+    if (results->num_rows == 0) {
+        fprintf(stderr, "%s holds no results\n", path);
+        exit(1);
+    }
+    qsort(results->rows, results->num_rows, sizeof(row_t), cmp_row);
+}
+
+static int cmp_row(const void *a, const void *b) {
+    return strcmp(((row_t *)a)->key, ((row_t *)b)->key);
+}
+
+/*
+ * summarize - summarize the rows sharing the key of row start, and
+ *     return the first row past them
+ */
+static int summarize(results_t *results, int start, summary_t *summary) {
+    int i, end = start;
+    double sum = 0, sq = 0;
+
+    while (end < results->num_rows &&
+           strcmp(results->rows[end].key, results->rows[start].key) == 0)
+        sum += results->rows[end++].value;
+    summary->n = end - start;
+    summary->mean = sum / summary->n;
+
+    for (i = start; i < end; i++)
+        sq += (results->rows[i].value - summary->mean) *
+            (results->rows[i].value - summary->mean);
+    summary->var = (summary->n > 1) ? sq / (summary->n - 1) : 0;
+    return end;
+}
+
+/*
+ * t_quantile - the two-sided 95% quantile of Student's t distribution
+ */
+static double t_quantile(double df) {
+    static double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    int rows = sizeof(table) / sizeof(double);
+
+    if (df < 1)
+        return table[0];
+    if (df <= rows)
+        return table[(int)df - 1]; /* rounding df down is conservative */
+    return 1.960 + 2.4 / df;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void) {
+    fprintf(stderr, "Usage: mdcompare [-h] [-t <pct>] <base.csv> <new.csv>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-t <pct>   Ignore changes smaller than pct percent (1).\n");
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg) {
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
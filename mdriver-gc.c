@@ -0,0 +1,757 @@
+/*
+ * mdriver-gc.c - Garbage collector benchmark driver
+ *
+ * Replays GC workload traces against the collector in mm.c and reports
+ * the total time spent collecting, the maximum and 99th percentile
+ * pause, and the live heap left after every cycle. In the incremental
+ * mode, the collecting allocations do and the cycles a GC point has to
+ * finish at once are reported apart from the pauses of the steps.
+ *
+ * A GC trace has the four header lines of a .rep trace followed by one
+ * request per line:
+ *
+ *   a <id> <size>             allocate a zeroed block of size bytes
+ *   f <id>                    free a block explicitly
+ *   p <src> <offset> <dst>    store a pointer to dst, or NULL if dst is -1,
+ *                             at byte offset of src's payload
+ *   r <id>                    make a block a root
+ *   u <id>                    stop treating a block as a root
+ *   g                         collect garbage
+ *
+ * Pointers are stored through the write barrier. Blocks that are
+ * neither roots nor reachable from one are reclaimed at the next GC
+ * point, after which the trace must not mention them again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+
+/* Misc */
+#define MAXLINE     1024 /* max string size */
+#define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+
+/*
+ * Every block carries its id in a hidden word in front of the payload,
+ * so the driver can find its blocks again after they were moved
+ */
+#define TAG_SIZE sizeof(long)
+
+/* Words of marking work per step of the incremental mode */
+#define DEFAULT_STEP_BUDGET 256
+
+/******************************
+ * The key compound data types
+ *****************************/
+
+/* Characterizes a single trace operation */
+typedef struct {
+    enum {ALLOC, FREE, STORE, ROOT, UNROOT, COLLECT} type; /* type of request */
+    int index;                /* block id, or the source of a store */
+    int size;                 /* byte size of alloc request, or store offset */
+    int target;               /* destination id of a store, -1 for NULL */
+} gcop_t;
+
+/* Holds the information for one trace file */
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    gcop_t *ops;         /* array of requests */
+    char **blocks;       /* payloads of the live blocks, NULL once dead... */
+    size_t *block_sizes; /* ... along with their sizes... */
+    void **roots;        /* ... and the registered root slot of each id */
+} trace_t;
+
+/* How GC points are served */
+typedef enum {
+    STOP_THE_WORLD, /* mm_garbage_collect at every GC point */
+    INCREMENTAL,    /* mm_gc_start, then one mm_gc_step per request */
+    COMPACTING      /* mm_gc_compact at every GC point */
+} gcmode_t;
+
+/* Summarizes the collector's behavior on one trace */
+typedef struct {
+    double ops;         /* number of requests in the trace */
+    int valid;          /* did every reachable block survive? */
+    double secs;        /* secs needed to replay the trace */
+    double gc_secs;     /* secs of those spent in the collector... */
+    double assist_secs; /* ... of which allocations spent collecting */
+    int forced;         /* cycles a GC point finished, not counted as pauses */
+    double max_pause;   /* longest pause in secs */
+    double p99_pause;   /* 99th percentile pause in secs */
+    int cycles;         /* number of finished collections */
+    double avg_live;    /* average live payload bytes after a cycle */
+} gcstats_t;
+
+/********************
+ * Global variables
+ *******************/
+int verbose = 0;        /* global flag for verbose output */
+static int errors = 0;  /* number of errs found while replaying */
+char msg[MAXLINE];      /* for whenever we need to compose an error message */
+
+/* Directory where default tracefiles are found */
+static char tracedir[MAXLINE] = TRACEDIR;
+
+/* The filenames of the default tracefiles */
+static char *default_tracefiles[] = {
+    DEFAULT_GC_TRACEFILES, NULL
+};
+
+static gcmode_t mode = STOP_THE_WORLD;
+static size_t step_budget = DEFAULT_STEP_BUDGET;
+
+/* Pause of every collector call of the current trace, in secs */
+static double *pauses = NULL;
+static int num_pauses = 0;
+static int pauses_capacity = 0;
+
+/*********************
+ * Function prototypes
+ *********************/
+
+/* These functions read and free storage for traces */
+static trace_t *read_trace(char *tracedir, char *filename);
+static void free_trace(trace_t *trace);
+
+/* These functions replay a trace and account for its collections */
+static int eval_gc(trace_t *trace, int tracenum, gcstats_t *stats);
+static void timed_collect(gcstats_t *stats);
+static int timed_step(gcstats_t *stats, size_t budget);
+static double timed_finish(gcstats_t *stats);
+static void record_pause(gcstats_t *stats, double pause);
+static int finish_cycle(trace_t *trace, int tracenum, int opnum,
+                        gcstats_t *stats, double forced);
+static char *live_block(trace_t *trace, int tracenum, int opnum, int index);
+static int cmp_pause(const void *a, const void *b);
+
+/* Various helper routines */
+static double now(void);
+static void printresults(int n, gcstats_t *stats);
+static void usage(void);
+static void unix_error(char *msg);
+static void malloc_error(int tracenum, int opnum, char *msg);
+static void app_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv) {
+    int i;
+    char c;
+    char **tracefiles = NULL;  /* null-terminated array of trace file names */
+    int num_tracefiles = 0;    /* the number of traces in that array */
+    trace_t *trace = NULL;     /* stores a single trace file in memory */
+    gcstats_t *stats = NULL;   /* collector stats for each trace */
+
+    /*
+     * Read and interpret the command line arguments
+     */
+    while ((c = getopt(argc, argv, "f:t:m:b:hvV")) != EOF) {
+        switch (c) {
+        case 'f': /* Use one specific trace file only (relative to curr dir) */
+            num_tracefiles = 1;
+            if ((tracefiles = realloc(tracefiles, 2*sizeof(char *))) == NULL)
+                unix_error("ERROR: realloc failed in main");
+            strcpy(tracedir, "./");
+            tracefiles[0] = strdup(optarg);
+            tracefiles[1] = NULL;
+            break;
+        case 't': /* Directory where the traces are located */
+            if (num_tracefiles == 1) /* ignore if -f already encountered */
+                break;
+            strcpy(tracedir, optarg);
+            if (tracedir[strlen(tracedir)-1] != '/')
+                strcat(tracedir, "/"); /* path always ends with "/" */
+            break;
+        case 'm': /* Collector mode */
+            if (strcmp(optarg, "stw") == 0)
+                mode = STOP_THE_WORLD;
+            else if (strcmp(optarg, "incremental") == 0)
+                mode = INCREMENTAL;
+            else if (strcmp(optarg, "compact") == 0)
+                mode = COMPACTING;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'b': /* Marking budget of an incremental step */
+            step_budget = strtoul(optarg, NULL, 10);
+            break;
+        case 'v': /* Print every cycle */
+            verbose = 1;
+            break;
+        case 'V': /* Be more verbose than -v */
+            verbose = 2;
+            break;
+        case 'h': /* Print this message */
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    /*
+     * If no -f command line arg, then use the entire set of tracefiles
+     * defined in default_traces[]
+     */
+    if (tracefiles == NULL) {
+        tracefiles = default_tracefiles;
+        num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
+        printf("Using default tracefiles in %s\n", tracedir);
+    }
+
+    if ((stats = (gcstats_t *)calloc(num_tracefiles, sizeof(gcstats_t))) == NULL)
+        unix_error("stats calloc in main failed");
+
+    /* Initialize the simulated memory system in memlib.c */
+    mem_init();
+
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        stats[i].ops = trace->num_ops;
+        if (verbose)
+            printf("Trace %d (%s):\n", i, tracefiles[i]);
+        stats[i].valid = eval_gc(trace, i, &stats[i]);
+        free_trace(trace);
+    }
+
+    printresults(num_tracefiles, stats);
+
+    if (errors > 0)
+        printf("Terminated with %d errors\n", errors);
+
+    exit(0);
+}
+
+
+/**********************************************
+ * The following routines manipulate tracefiles
+ *********************************************/
+
+/*
+ * read_trace - read a GC trace file and store it in memory
+ */
+static trace_t *read_trace(char *tracedir, char *filename) {
+    FILE *tracefile;
+    trace_t *trace;
+    char type[MAXLINE];
+    char path[MAXLINE];
+    int index, size, target;
+    int op_index;
+
+    if (verbose > 1)
+        printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+        unix_error("malloc 1 failed in read_trace");
+
+    /* Read the trace file header */
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+        snprintf(msg, sizeof(msg), "Could not open %s in read_trace", path);
+        unix_error(msg);
+    }
+    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+    fscanf(tracefile, "%d", &(trace->num_ids));
+    fscanf(tracefile, "%d", &(trace->num_ops));
+    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops =
+         (gcop_t *)malloc(trace->num_ops * sizeof(gcop_t))) == NULL)
+        unix_error("malloc 2 failed in read_trace");
+
+    /* Every id starts out without a block and without a root */
+    if ((trace->blocks =
+         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in read_trace");
+    if ((trace->block_sizes =
+         (size_t *)calloc(trace->num_ids, sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+    if ((trace->roots =
+         (void **)calloc(trace->num_ids, sizeof(void *))) == NULL)
+        unix_error("malloc 5 failed in read_trace");
+
+    /* read every request line in the trace file */
+    op_index = 0;
+    while (op_index < trace->num_ops && fscanf(tracefile, "%s", type) != EOF) {
+        gcop_t *op = &trace->ops[op_index];
+        index = size = 0;
+        target = -1;
+
+        switch (type[0]) {
+        case 'a':
+            fscanf(tracefile, "%d %d", &index, &size);
+            op->type = ALLOC;
+            break;
+        case 'f':
+            fscanf(tracefile, "%d", &index);
+            op->type = FREE;
+            break;
+        case 'p':
+            fscanf(tracefile, "%d %d %d", &index, &size, &target);
+            op->type = STORE;
+            break;
+        case 'r':
+            fscanf(tracefile, "%d", &index);
+            op->type = ROOT;
+            break;
+        case 'u':
+            fscanf(tracefile, "%d", &index);
+            op->type = UNROOT;
+            break;
+        case 'g':
+            op->type = COLLECT;
+            break;
+        default:
+            printf("Bogus type character (%c) in tracefile %s\n",
+                   type[0], path);
+            exit(1);
+        }
+
+        if (size < 0) {
+            printf("Negative size or offset on line %d of tracefile %s\n",
+                   LINENUM(op_index), path);
+            exit(1);
+        }
+        if (index < 0 || index >= trace->num_ids ||
+            target < -1 || target >= trace->num_ids) {
+            printf("Id out of range on line %d of tracefile %s\n",
+                   LINENUM(op_index), path);
+            exit(1);
+        }
+        op->index = index;
+        op->size = size;
+        op->target = target;
+        op_index++;
+    }
+    fclose(tracefile);
+    assert(trace->num_ops == op_index);
+
+    return trace;
+}
+
+/*
+ * free_trace - Free the trace record and the arrays it points to,
+ *              all of which were allocated in read_trace().
+ */
+static void free_trace(trace_t *trace) {
+    free(trace->ops);
+    free(trace->blocks);
+    free(trace->block_sizes);
+    free(trace->roots);
+    free(trace);
+}
+
+/**********************************************************************
+ * The following functions replay a trace and account for the
+ * collector's pauses.
+ **********************************************************************/
+
+/*
+ * eval_gc - Replay a trace, timing every call into the collector
+ */
+static int eval_gc(trace_t *trace, int tracenum, gcstats_t *stats) {
+    int i, index;
+    int collecting = 0; /* an incremental cycle is in progress */
+    double start;
+    char *p, *src;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        malloc_error(tracenum, 0, "mm_init failed.");
+        return 0;
+    }
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(trace->roots, 0, trace->num_ids * sizeof(void *));
+    num_pauses = 0;
+    stats->cycles = 0;
+    stats->forced = 0;
+    stats->gc_secs = 0;
+    stats->avg_live = 0;
+
+    start = now();
+    for (i = 0;  i < trace->num_ops;  i++) {
+        gcop_t *op = &trace->ops[i];
+        index = op->index;
+
+        /* An incremental cycle advances by one step per request */
+        if (collecting && timed_step(stats, step_budget)) {
+            collecting = 0;
+            if (!finish_cycle(trace, tracenum, i, stats, -1))
+                return 0;
+        }
+
+        switch (op->type) {
+        case ALLOC:
+            if ((p = mm_malloc(op->size + TAG_SIZE)) == NULL) {
+                malloc_error(tracenum, i, "mm_malloc failed.");
+                return 0;
+            }
+
+            /* Conservative scanning must not see stale pointers */
+            memset(p, 0, op->size + TAG_SIZE);
+            *(long *)p = index;
+            trace->blocks[index] = p + TAG_SIZE;
+            trace->block_sizes[index] = op->size;
+            break;
+
+        case FREE:
+            if ((p = live_block(trace, tracenum, i, index)) == NULL)
+                return 0;
+            if (trace->roots[index] != NULL) {
+                mm_gc_unregister_root(&trace->roots[index]);
+                trace->roots[index] = NULL;
+            }
+            mm_free(p - TAG_SIZE);
+            trace->blocks[index] = NULL;
+            break;
+
+        case STORE:
+            if ((src = live_block(trace, tracenum, i, index)) == NULL)
+                return 0;
+            p = NULL;
+            if (op->target >= 0 &&
+                (p = live_block(trace, tracenum, i, op->target)) == NULL)
+                return 0;
+            if (op->size % sizeof(void *) != 0 ||
+                op->size + sizeof(void *) > trace->block_sizes[index]) {
+                malloc_error(tracenum, i, "Store lies outside its block.");
+                return 0;
+            }
+            mm_gc_write_barrier(src, (void **)(src + op->size), p);
+            break;
+
+        case ROOT:
+            if ((p = live_block(trace, tracenum, i, index)) == NULL)
+                return 0;
+            if (trace->roots[index] == NULL)
+                mm_gc_register_root(&trace->roots[index]);
+            trace->roots[index] = p;
+            break;
+
+        case UNROOT:
+            if (trace->roots[index] != NULL) {
+                mm_gc_unregister_root(&trace->roots[index]);
+                trace->roots[index] = NULL;
+            }
+            break;
+
+        case COLLECT:
+            /* A GC point during a cycle finishes it first */
+            if (collecting) {
+                collecting = 0;
+                if (!finish_cycle(trace, tracenum, i, stats, timed_finish(stats)))
+                    return 0;
+            }
+
+            timed_collect(stats);
+            if (mode == INCREMENTAL) {
+                collecting = 1;
+                break;
+            }
+            if (!finish_cycle(trace, tracenum, i, stats, -1))
+                return 0;
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_gc");
+        }
+    }
+
+    /* Let the last cycle run to completion */
+    if (collecting) {
+        if (!finish_cycle(trace, tracenum, i, stats, timed_finish(stats)))
+            return 0;
+    }
+    stats->secs = now() - start;
+
+    /* Collecting inside mm_malloc is not a pause, but it is GC time */
+    stats->assist_secs = mm_gc_assist_ns() / 1e9;
+    stats->gc_secs += stats->assist_secs;
+
+    /* Summarize the pauses */
+    stats->max_pause = 0;
+    stats->p99_pause = 0;
+    if (num_pauses > 0) {
+        qsort(pauses, num_pauses, sizeof(double), cmp_pause);
+        stats->max_pause = pauses[num_pauses - 1];
+        stats->p99_pause = pauses[(num_pauses * 99 + 99) / 100 - 1];
+    }
+    if (stats->cycles > 0)
+        stats->avg_live /= stats->cycles;
+
+    /* Registered roots outlive the trace's arrays otherwise */
+    for (i = 0; i < trace->num_ids; i++)
+        if (trace->roots[i] != NULL)
+            mm_gc_unregister_root(&trace->roots[i]);
+
+    return 1;
+}
+
+/*
+ * timed_collect - Serve a GC point in the current mode, recording the
+ *     pause. In the incremental mode this only starts a cycle.
+ */
+static void timed_collect(gcstats_t *stats) {
+    double begin = now();
+
+    switch (mode) {
+    case STOP_THE_WORLD:
+        mm_garbage_collect(NULL, 0);
+        break;
+    case INCREMENTAL:
+        mm_gc_start(NULL, 0);
+        break;
+    case COMPACTING:
+        mm_gc_compact();
+        break;
+    }
+
+    record_pause(stats, now() - begin);
+}
+
+/*
+ * timed_step - Advance an incremental cycle by budget words of work,
+ *     recording the pause. Returns whether the cycle finished.
+ */
+static int timed_step(gcstats_t *stats, size_t budget) {
+    double begin = now();
+    int done = mm_gc_step(budget);
+
+    record_pause(stats, now() - begin);
+    return done;
+}
+
+/*
+ * timed_finish - Run an incremental cycle to completion. That is not a
+ *     step of bounded work, so it counts as GC time but not as a pause.
+ *     Returns the secs it took.
+ */
+static double timed_finish(gcstats_t *stats) {
+    double begin = now();
+    double secs;
+
+    mm_gc_step(SIZE_MAX);
+    secs = now() - begin;
+    stats->gc_secs += secs;
+    stats->forced++;
+    return secs;
+}
+
+/*
+ * record_pause - Remember the length of one call into the collector
+ */
+static void record_pause(gcstats_t *stats, double pause) {
+    if (num_pauses == pauses_capacity) {
+        pauses_capacity = (pauses_capacity == 0) ? 256 : 2 * pauses_capacity;
+        if ((pauses = realloc(pauses, pauses_capacity * sizeof(double))) == NULL)
+            unix_error("realloc failed in record_pause");
+    }
+    pauses[num_pauses++] = pause;
+    stats->gc_secs += pause;
+}
+
+/*
+ * finish_cycle - After a collection, find the surviving blocks by their
+ *     tags, which also picks up blocks that were moved, and check that
+ *     every block reachable from a root survived. forced is the secs of
+ *     the timed_finish that ended the cycle, or negative if a pause did.
+ */
+static int finish_cycle(trace_t *trace, int tracenum, int opnum,
+                        gcstats_t *stats, double forced) {
+    Block *block;
+    size_t live = 0;
+    int i;
+    char **stack;
+    int top = 0;
+
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    for (block = first_block(); block != NULL; block = next_block(block)) {
+        if (block->info.size <= 0)
+            continue;
+        char *p = (char *)UNSCALED_POINTER_ADD(block, INFO_SIZE);
+        trace->blocks[*(long *)p] = p + TAG_SIZE;
+        live += block->info.size;
+    }
+
+    /* Walk the stored pointers from the roots */
+    if ((stack = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+        unix_error("malloc failed in finish_cycle");
+    for (i = 0; i < trace->num_ids; i++) {
+        if (trace->roots[i] == NULL)
+            continue;
+        if (trace->blocks[i] != trace->roots[i]) {
+            snprintf(msg, sizeof(msg), "Root block %d did not survive the collection", i);
+            malloc_error(tracenum, opnum, msg);
+            free(stack);
+            return 0;
+        }
+        stack[top++] = trace->roots[i];
+    }
+
+    char *seen = (char *)calloc(trace->num_ids, 1);
+    if (seen == NULL)
+        unix_error("calloc failed in finish_cycle");
+    while (top > 0) {
+        char *p = stack[--top];
+        long id = *(long *)(p - TAG_SIZE);
+        if (seen[id])
+            continue;
+        seen[id] = 1;
+
+        char **slots = (char **)p;
+        for (i = 0; i < (int)(trace->block_sizes[id] / sizeof(char *)); i++) {
+            char *q = slots[i];
+            if (q == NULL)
+                continue;
+            long target = *(long *)(q - TAG_SIZE);
+            if (target < 0 || target >= trace->num_ids ||
+                trace->blocks[target] != q) {
+                snprintf(msg, sizeof(msg), "A block reachable from block %ld was collected", id);
+                malloc_error(tracenum, opnum, msg);
+                free(stack);
+                free(seen);
+                return 0;
+            }
+            if (!seen[target])
+                stack[top++] = q;
+        }
+    }
+    free(stack);
+    free(seen);
+
+    if (verbose && forced >= 0)
+        printf("  cycle %d: forced finish %.1f us, live %zu bytes\n",
+               stats->cycles, forced * 1e6, live);
+    else if (verbose)
+        printf("  cycle %d: pause %.1f us, live %zu bytes\n",
+               stats->cycles, pauses[num_pauses - 1] * 1e6, live);
+    stats->cycles++;
+    stats->avg_live += live;
+
+    return 1;
+}
+
+/*
+ * live_block - Return the payload of block index, reporting an error if
+ *     the trace mentions a block that was freed or collected
+ */
+static char *live_block(trace_t *trace, int tracenum, int opnum, int index) {
+    if (trace->blocks[index] == NULL) {
+        snprintf(msg, sizeof(msg), "Block %d is used after it was freed or collected", index);
+        malloc_error(tracenum, opnum, msg);
+    }
+    return trace->blocks[index];
+}
+
+/*
+ * cmp_pause - Order pauses for qsort
+ */
+static int cmp_pause(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+/*
+ * now - Return a monotonic time stamp in secs
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * printresults - prints a summary of the collector on every trace
+ */
+static void printresults(int n, gcstats_t *stats) {
+    int i;
+
+    printf("%5s%7s%8s%8s%10s%10s%10s%12s%12s%8s%10s\n",
+           "trace", " valid", "ops", "cycles", "secs", "gc secs", "assist",
+           "max pause", "p99 pause", "forced", "live KB");
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid) {
+            printf("%2d%10s%8.0f%8d%10.6f%10.6f%10.6f%10.1fus%10.1fus%8d%10.1f\n",
+                   i,
+                   "yes",
+                   stats[i].ops,
+                   stats[i].cycles,
+                   stats[i].secs,
+                   stats[i].gc_secs,
+                   stats[i].assist_secs,
+                   stats[i].max_pause * 1e6,
+                   stats[i].p99_pause * 1e6,
+                   stats[i].forced,
+                   stats[i].avg_live / 1024);
+        } else {
+            printf("%2d%10s%8s%8s%10s%10s%10s%12s%12s%8s%10s\n",
+                   i, "no", "-", "-", "-", "-", "-", "-", "-", "-", "-");
+        }
+    }
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+void app_error(char *msg) {
+    printf("%s\n", msg);
+    exit(1);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+void unix_error(char *msg) {
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * malloc_error - Report an error found while replaying a trace
+ */
+void malloc_error(int tracenum, int opnum, char *msg) {
+    errors++;
+    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void) {
+    fprintf(stderr, "Usage: mdriver-gc [-hvV] [-f <file>] [-t <dir>] [-m <mode>] [-b <words>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <words> Marking budget of an incremental step.\n");
+    fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-m <mode>  Collect with stw (default), incremental or compact.\n");
+    fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-v         Print the pause and live heap of every cycle.\n");
+    fprintf(stderr, "\t-V         Print additional debug info.\n");
+}
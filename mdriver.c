@@ -1,8 +1,8 @@
 /*
  * mdriver.c - CS:APP Malloc Lab Driver
  *
- * Uses a collection of trace files to tests a malloc/free
- * implementation in mm.c.
+ * Uses a collection of trace files to tests a malloc/free/realloc
+ * implementation in mm.c, along with its calloc and memalign.
  *
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -15,11 +15,23 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <execinfo.h>
+#include <signal.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "lathist.h"
+#include "perfctr.h"
 #include "config.h"
+#include "tracebin.h"
 
 /**********************
  * Constants and macros
@@ -29,30 +41,104 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define STREAM_WINDOW (1<<16) /* requests read at a time when streaming */
+#define TOUCH_STRIDE  64      /* bytes between the bytes -a re-reads, a cache line */
+#define TOUCH_CLOCK_READS 1000 /* pairs of clock reads -a takes the cheapest of */
+
+/* Makes an allocator call, timing it into latency[type] unless latency is NULL */
+#define TIMED(latency, type, call)                                    \
+    do {                                                              \
+        if ((latency) != NULL) {                                      \
+            start_counter();                                          \
+            call;                                                     \
+            lathist_record(&(latency)[type], (uint64_t)get_counter()); \
+        } else {                                                      \
+            call;                                                     \
+        }                                                             \
+    } while (0)
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
 
+/* Number of ALIGNMENT-byte granules, and 64-bit words of granule bits, in the heap */
+#define NUM_GRANULES   (MAX_HEAP / ALIGNMENT)
+#define GRANULE_WORDS  ((NUM_GRANULES + 63) / 64)
+
 /******************************
  * The key compound data types
  *****************************/
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload in a shadow bitmap with one
+ * bit per ALIGNMENT-byte granule of the heap. Payloads are aligned, so
+ * two of them overlap exactly when they share a granule, and checking or
+ * removing a payload costs O(size/ALIGNMENT) no matter how many are live.
+ */
 typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    uint64_t *used;        /* set for every granule a payload covers */
+    uint64_t *starts;      /* set for the first granule of every payload */
+    size_t hi_word;        /* words past the last one ever set */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, CALLOC, MEMALIGN, SIZED_FREE,
+          NUM_OP_TYPES} type;         /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc request */
+    int size;                         /* byte size of alloc request, in total for calloc */
+    int arg;                          /* calloc's element count or memalign's alignment */
+    int tid;                          /* thread that made the request, 0 if not recorded */
+    int pad;
+    int64_t time;                     /* when it was made in ns, 0 if not recorded */
 } traceop_t;
 
+/* Names of the request types, which also get a latency histogram each */
+static char *op_names[NUM_OP_TYPES] = {
+    "malloc", "free", "realloc", "calloc", "memalign", "sized_free"
+};
+
+/* Binary traces are replayed in place, so their records must match */
+typedef char traceop_matches_tracebin[(sizeof(traceop_t) == sizeof(tracebin_op_t) &&
+                                       ALLOC == TRACEBIN_ALLOC &&
+                                       FREE == TRACEBIN_FREE &&
+                                       REALLOC == TRACEBIN_REALLOC &&
+                                       CALLOC == TRACEBIN_CALLOC &&
+                                       MEMALIGN == TRACEBIN_MEMALIGN &&
+                                       SIZED_FREE == TRACEBIN_SIZED_FREE) ? 1 : -1];
+
+/*
+ * Reads the requests of a streamed trace in fixed windows. A reader
+ * thread fills one window while the replay consumes the other, so only
+ * two windows of the trace are ever in memory.
+ */
+typedef struct {
+    FILE *file;              /* the trace file */
+    long start;              /* offset of its first request */
+    int binary;              /* holds records rather than request lines? */
+    int num_ids;             /* the ids its records may use */
+    traceop_t *windows[2];   /* the window being replayed and the next one */
+    int counts[2];           /* requests in each window, 0 past the end */
+    int filled[2];           /* has the reader filled the window? */
+    int current;             /* the window being replayed */
+    int holding;             /* does the replay hold the current window? */
+    int pos;                 /* next request in it... */
+    int limit;               /* ... and its count, read under the lock */
+    int done;                /* tells the reader to stop */
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} stream_t;
+
+/* A live block of a streamed trace, hashed by its id */
+typedef struct {
+    int index;               /* block id, or -1 for an empty slot */
+    char *block;
+    size_t size;
+} idslot_t;
+
 /* Holds the information for one trace file*/
 typedef struct {
+    char *name;          /* the trace file, as named on the command line */
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc ids */
     int num_ops;         /* number of distinct requests */
@@ -60,8 +146,33 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace, or NULL */
+    size_t map_size;     /* bytes of that mapping */
+    int next_op;         /* next request to replay from ops */
+    stream_t *stream;    /* reads the requests instead of ops, or NULL */
+    idslot_t *live;      /* a streamed trace's blocks, in place of blocks */
+    size_t live_capacity;/* slots in live, a power of two */
+    size_t num_live;     /* live blocks */
 } trace_t;
 
+/*
+ * The application side of a replay with -a, which writes every payload
+ * when it is allocated and every so often re-reads random live ones
+ */
+typedef struct {
+    char **blocks;       /* the live payloads, in no order... */
+    size_t *sizes;       /* ... their sizes... */
+    int *ids;            /* ... and their ids */
+    int *slots;          /* where each live id is in those arrays */
+    int num_live;
+    int requests;        /* requests since the last re-read */
+    uint64_t seed;       /* picks the payloads to re-read */
+    volatile char sink;  /* keeps the re-reads from being optimized away */
+    double secs;         /* spent touching, summed over the replays... */
+    int replays;         /* ... since these were last zeroed */
+    double clock_secs;   /* what timing a touch adds to it */
+} touch_t;
+
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -70,17 +181,71 @@ typedef struct {
 typedef struct {
     trace_t *trace;
     range_t *ranges;
+    lathist_t *latency;  /* a histogram per request type to time each
+                            request into, or NULL to run untimed */
+    touch_t *touch;      /* touches the payloads as an application would,
+                            or NULL to only call the allocator */
 } speed_t;
 
+/* A trace being replayed on several threads at once */
+typedef struct {
+    trace_t *trace;
+    int mm;              /* replay against mm rather than libc? */
+    int *turns;          /* for a partitioned trace, the number of earlier
+                            requests on each request's block... */
+    int *done;           /* ... and the requests made on each block so far */
+    char **blocks;       /* a partitioned trace's blocks, shared by its threads */
+    size_t *block_sizes;
+    size_t heap;         /* mm's heap size after a replay on one thread */
+    pthread_barrier_t start; /* releases the threads all at once */
+} scaling_t;
+
+/* One of the threads replaying a trace */
+typedef struct {
+    scaling_t *scale;
+    int *ops;            /* its requests of a partitioned trace, or NULL
+                            to replay all of them as a copy of its own */
+    int num_ops;
+    char **blocks;       /* the blocks it allocated... */
+    size_t *block_sizes; /* ... and their sizes */
+    int timed;           /* time every request into latency? */
+    lathist_t latency;   /* cycles per request in this run... */
+    lathist_t total;     /* ... and in every run */
+    struct timespec start, end; /* when it started and finished its requests */
+    pthread_t thread;
+} replayer_t;
+
+/* One measurement from one run of a trace, for the results file */
+typedef struct {
+    char metric[32];  /* what was measured, e.g. secs or malloc_p99 */
+    int run;          /* which of the runs it came from */
+    double value;
+} sample_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
-    double secs;     /* number of secs needed to run the trace */
+    double secs;     /* number of secs needed to run the trace, averaged
+                        over the runs */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    lathist_t *latency; /* cycles per request, by type, or NULL */
+    double counters[NUM_PERFCTRS]; /* hardware events per run, -1 if
+                                      unavailable (only set with -c) */
+    double app_secs;    /* secs spent touching the payloads (only set with -a) */
+    double app_counters[NUM_PERFCTRS]; /* ... and the hardware events they
+                                          added per run (with -a and -c) */
+    PhaseProfile profile[PROFILE_NUM_PHASES]; /* where mm spent one more
+                                                 run (mm.c built with PROFILE) */
+    double profile_cycles; /* ... and that run's cycles */
+    int profiled;
+    HeapSite *sites;    /* call sites mm sampled, heaviest first (with -H) */
+    int num_sites;
+    sample_t *samples;  /* every run's measurements, for -o */
+    int num_samples;
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -100,37 +265,129 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* If set, traces are streamed rather than loaded (set by -S) */
+static int streaming = 0;
+
+/* If set, hardware events are counted for every trace (set by -c) */
+static int counting = 0;
+static perfctr_t perfctrs;
+
+/* Times each trace is measured, for confidence intervals (set by -n) */
+static int num_runs = 1;
+
+/* If set, the heap is sampled every timeline_interval requests while
+   measuring utilization, and written here as CSV (set by -u and -i) */
+static FILE *timeline = NULL;
+static int timeline_interval = 1000;
+
+/* If set, the speed runs are repeated touching the payloads, re-reading
+   touch_blocks random live ones every touch_every requests (set by -a) */
+static int touching = 0;
+static int touch_every = 16;
+static int touch_blocks = 4;
+
+/* If set, mm samples about one allocation in every this many bytes while
+   measuring utilization, and the heaviest call sites are printed (set by -H) */
+static size_t sample_bytes = 0;
+#define NUM_PRINTED_SITES 5
+
+/* Most threads to replay each trace on at once, 0 for none (set by -T) */
+static int max_threads = 0;
+
+/* If set, each thread replays the requests of one recorded thread
+   rather than a copy of the whole trace (set by -P) */
+static int partitioning = 0;
+
+/* mm is not thread-safe, so threads replaying a trace take turns in it */
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The percentiles reported for each request type */
+static double lat_percentiles[] = {0.50, 0.90, 0.99, 0.999};
+static char *lat_percentile_names[] = {"p50", "p90", "p99", "p99.9"};
+#define NUM_LAT_PERCENTILES (sizeof(lat_percentiles) / sizeof(double))
+
+/* Names of mm's profiled phases, numbered like ProfilePhase */
+static char *phase_names[PROFILE_NUM_PHASES] = {
+    "search", "split", "coalesce", "add_free", "grow"
+};
+
 
 /*********************
  * Function prototypes
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate the range map */
 static int add_range(range_t **ranges, char *lo, int size,
                      int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static size_t find_granule(uint64_t *bits, uint64_t *stops, size_t lo, size_t hi);
+static size_t payload_end(range_t *ranges, size_t start);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, char *path);
+static int read_op(FILE *tracefile, traceop_t *op, char *path);
+static void check_records(traceop_t *ops, int first, int count, int num_ids,
+                          char *path);
 static void free_trace(trace_t *trace);
 
+/* These functions replay a trace's requests, whether loaded or streamed */
+static void open_ops(trace_t *trace);
+static traceop_t *next_op(trace_t *trace);
+static void close_ops(trace_t *trace);
+static void *stream_reader(void *arg);
+static void set_block(trace_t *trace, int index, char *p, size_t size);
+static char *take_block(trace_t *trace, int index, size_t *size);
+static idslot_t *find_slot(trace_t *trace, int index);
+
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
+static char *libc_alloc_op(traceop_t *op);
 static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static void sample_heap(trace_t *trace, int opnum, size_t live_bytes);
 static void eval_mm_speed(void *ptr);
+static char *mm_alloc_op(traceop_t *op);
+
+/* Routines for touching the payloads as an application would */
+static void touch_open(touch_t *touch, trace_t *trace);
+static void touch_reset(touch_t *touch);
+static void touch_op(touch_t *touch, traceop_t *op, char *p);
+static void touch_close(touch_t *touch);
+
+/* Routines for replaying a trace on several threads at once */
+static void eval_scaling(trace_t *trace, int tracenum, int mm, stats_t *stats);
+static double run_replay(scaling_t *scale, replayer_t *replayers, int threads,
+                         int timed);
+static void *replay_thread(void *arg);
+static void replay_request(replayer_t *r, traceop_t *op);
 
 /* Various helper routines */
+static void measure_trace(fsecs_test_funct f, speed_t *params, stats_t *stats,
+                          int time_requests);
+static void count_events(fsecs_test_funct f, speed_t *params, double *counters);
+static void profile_phases(speed_t *params, stats_t *stats);
+static void collect_sites(stats_t *stats);
+static int compare_sites(const void *a, const void *b);
+static void record_sample(stats_t *stats, char *metric, int run, double value);
+static void write_results(char *path, int n, char **tracefiles,
+                          stats_t *libc_stats, stats_t *mm_stats, double perfindex);
 static void printresults(int n, stats_t *stats);
+static void printcounters(double *counters, double ops);
+static void printlatency(int n, stats_t *stats);
+static void printtouch(int n, stats_t *stats);
+static void printprofile(int n, stats_t *stats);
+static void printsites(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
+static void crash_handler(int sig);
 
 /**************
  * Main routine
@@ -148,6 +405,9 @@ int main(int argc, char **argv) {
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int percentiles = 0; /* If set, report per-request latency (set by -p) */
+    char *results = NULL;/* If set, write every sample to this file (-o) */
+    PhaseProfile phases[PROFILE_NUM_PHASES]; /* only checks mm was built with PROFILE */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -156,8 +416,14 @@ int main(int argc, char **argv) {
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgl")) != EOF) {
+    while ((c = getopt(argc, argv, "a:f:t:hvVgcH:i:ln:o:pPST:u:")) != EOF) {
         switch (c) {
+        case 'a': /* Touch the payloads, re-reading some every so often */
+            if (sscanf(optarg, "%d:%d", &touch_every, &touch_blocks) != 2 ||
+                touch_every < 0 || touch_blocks < 0)
+                app_error("The touch pattern must be <every>:<blocks>");
+            touching = 1;
+            break;
         case 'g': /* Generate summary info for the autograder */
             autograder = 1;
             break;
@@ -176,9 +442,47 @@ int main(int argc, char **argv) {
             if (tracedir[strlen(tracedir)-1] != '/')
                 strcat(tracedir, "/"); /* path always ends with "/" */
             break;
+        case 'c': /* Count hardware events for each trace */
+            counting = 1;
+            break;
+        case 'H': /* Sample mm's allocations every this many bytes */
+            if (atol(optarg) < 1)
+                app_error("The sampling interval must be at least 1 byte");
+            sample_bytes = atol(optarg);
+            break;
+        case 'i': /* Sample the heap for -u every this many requests */
+            if ((timeline_interval = atoi(optarg)) < 1)
+                app_error("The sampling interval must be at least 1");
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'n': /* Measure each trace this many times */
+            if ((num_runs = atoi(optarg)) < 1)
+                app_error("The number of runs must be at least 1");
+            break;
+        case 'o': /* Write the results as JSON, or CSV for a .csv file */
+            results = optarg;
+            break;
+        case 'p': /* Report latency percentiles for every request type */
+            percentiles = 1;
+            break;
+        case 'P': /* Partition traces by recorded thread when scaling */
+            partitioning = 1;
+            break;
+        case 'S': /* Stream traces instead of loading them */
+            streaming = 1;
+            break;
+        case 'u': /* Write a utilization timeline of every trace */
+            if ((timeline = fopen(optarg, "w")) == NULL)
+                unix_error("Could not open the timeline file");
+            fprintf(timeline, "trace,op,live_bytes,heap_bytes,free_bytes,"
+                    "largest_free,free_blocks,util\n");
+            break;
+        case 'T': /* Replay each trace on up to this many threads at once */
+            if ((max_threads = atoi(optarg)) < 1)
+                app_error("The number of threads must be at least 1");
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -194,6 +498,9 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (max_threads > 0 && streaming)
+        app_error("Threads replay a trace from memory, so -T cannot be used with -S");
+
     /*
      * If no -f command line arg, then use the entire set of tracefiles
      * defined in default_traces[]
@@ -206,6 +513,13 @@ int main(int argc, char **argv) {
 
     /* Initialize the timing package */
     init_fsecs();
+    speed_params.latency = NULL;
+    speed_params.touch = NULL;
+    if (counting && perfctr_open(&perfctrs) == 0) {
+        printf("Hardware counters are unavailable (%s), so none are reported\n",
+               strerror(errno));
+        counting = 0;
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package
@@ -230,7 +544,7 @@ int main(int argc, char **argv) {
                 speed_params.trace = trace;
                 if (verbose > 1)
                     printf("and performance.\n");
-                libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+                measure_trace(eval_libc_speed, &speed_params, &libc_stats[i], 0);
             }
             free_trace(trace);
         }
@@ -240,6 +554,10 @@ int main(int argc, char **argv) {
             printf("\nResults for libc malloc:\n");
             printresults(num_tracefiles, libc_stats);
         }
+        if (touching) {
+            printf("\nApplication time touching payloads with libc malloc:\n");
+            printtouch(num_tracefiles, libc_stats);
+        }
     }
 
     /*
@@ -256,6 +574,10 @@ int main(int argc, char **argv) {
     /* Initialize the simulated memory system in memlib.c */
     mem_init();
 
+    /* If mm crashes, show what it did last */
+    signal(SIGSEGV, crash_handler);
+    signal(SIGBUS, crash_handler);
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i = 0; i < num_tracefiles; i++) {
         trace = read_trace(tracedir, tracefiles[i]);
@@ -266,12 +588,18 @@ int main(int argc, char **argv) {
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
+            if (sample_bytes > 0)
+                mm_sample_heap(sample_bytes);
             mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+            if (sample_bytes > 0)
+                collect_sites(&mm_stats[i]);
+            record_sample(&mm_stats[i], "util", 0, mm_stats[i].util);
             speed_params.trace = trace;
             speed_params.ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+            measure_trace(eval_mm_speed, &speed_params, &mm_stats[i], percentiles);
+            profile_phases(&speed_params, &mm_stats[i]);
         }
         free_trace(trace);
     }
@@ -282,6 +610,42 @@ int main(int argc, char **argv) {
         printresults(num_tracefiles, mm_stats);
         printf("\n");
     }
+    if (percentiles) {
+        printf("Latency in cycles for mm malloc:\n");
+        printlatency(num_tracefiles, mm_stats);
+        printf("\n");
+    }
+    if (touching) {
+        printf("Application time touching payloads with mm malloc:\n");
+        printtouch(num_tracefiles, mm_stats);
+        printf("\n");
+    }
+    if (sample_bytes > 0) {
+        printf("Heaviest call sites sampled by mm malloc:\n");
+        printsites(num_tracefiles, mm_stats);
+        printf("\n");
+    }
+    if (mm_profile(phases)) {
+        printf("Cycles by phase of mm malloc:\n");
+        printprofile(num_tracefiles, mm_stats);
+        printf("\n");
+    }
+
+    /*
+     * Optionally replay every valid trace on several threads at once.
+     * Latencies are in cycles and include waiting for other threads.
+     */
+    if (max_threads > 0) {
+        for (i = 0; i < num_tracefiles; i++) {
+            trace = read_trace(tracedir, tracefiles[i]);
+            if (run_libc && libc_stats[i].valid)
+                eval_scaling(trace, i, 0, &libc_stats[i]);
+            if (mm_stats[i].valid)
+                eval_scaling(trace, i, 1, &mm_stats[i]);
+            free_trace(trace);
+        }
+        printf("\n");
+    }
 
     /*
      * Accumulate the aggregate statistics for the student's mm package
@@ -328,26 +692,65 @@ int main(int argc, char **argv) {
         printf("perfidx:%.0f\n", perfindex);
     }
 
+    if (results != NULL)
+        write_results(results, num_tracefiles, tracefiles, libc_stats, mm_stats,
+                      perfindex);
+    if (counting)
+        perfctr_close(&perfctrs);
+    if (timeline != NULL)
+        fclose(timeline);
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range map, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range map to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/*
+ * find_granule - Return the first granule in [lo, hi) whose bit is set
+ *     in bits or, if stops is not NULL, clear in stops. Returns hi if
+ *     there is none.
+ */
+static size_t find_granule(uint64_t *bits, uint64_t *stops, size_t lo, size_t hi) {
+    size_t word;
+    uint64_t mask;
+
+    for (word = lo / 64; word * 64 < hi; word++) {
+        mask = bits[word];
+        if (stops != NULL)
+            mask |= ~stops[word];
+        if (word == lo / 64)
+            mask &= ~(uint64_t)0 << (lo % 64);
+        if (mask != 0) {
+            size_t found = word * 64 + __builtin_ctzll(mask);
+            return (found < hi) ? found : hi;
+        }
+    }
+    return hi;
+}
+
+/*
+ * payload_end - Return the granule just past the payload that starts at
+ *     granule start: the next granule that is free or starts a payload
+ */
+static size_t payload_end(range_t *ranges, size_t start) {
+    return find_granule(ranges->starts, ranges->used, start + 1, NUM_GRANULES);
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we mark its granules in the range map.
  */
 static int add_range(range_t **ranges, char *lo, int size,
                      int tracenum, int opnum) {
     char *hi = lo + size - 1;
-    range_t *p;
+    char *heap_lo = (char *)mem_heap_lo();
+    size_t first, last, g;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -372,61 +775,65 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            examine_heap();
-            sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                    lo, hi, p->lo, p->hi);
-            malloc_error(tracenum, opnum, msg);
-            return 0;
-        }
+    first = (lo - heap_lo) / ALIGNMENT;
+    last = (hi - heap_lo) / ALIGNMENT;
+    if ((g = find_granule((*ranges)->used, NULL, first, last + 1)) <= last) {
+        size_t start = g;
+        while (!((*ranges)->starts[start / 64] >> (start % 64) & 1))
+            start--;
+        examine_heap();
+        sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                lo, hi, heap_lo + start * ALIGNMENT,
+                heap_lo + payload_end(*ranges, start) * ALIGNMENT - 1);
+        malloc_error(tracenum, opnum, msg);
+        return 0;
     }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by marking its granules in the range map.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-        unix_error("malloc error in add_range");
-    p->next = *ranges;
-    p->lo = lo;
-    p->hi = hi;
-    *ranges = p;
+    (*ranges)->starts[first / 64] |= (uint64_t)1 << (first % 64);
+    for (g = first; g <= last; g++)
+        (*ranges)->used[g / 64] |= (uint64_t)1 << (g % 64);
+    if (last / 64 + 1 > (*ranges)->hi_word)
+        (*ranges)->hi_word = last / 64 + 1;
     return 1;
 }
 
 /*
- * remove_range - Free the range record of block whose payload starts at lo
+ * remove_range - Clear the granules of the block whose payload starts at lo
  */
 static void remove_range(range_t **ranges, char *lo) {
-    range_t *p;
-    range_t **prevpp = ranges;
-    // int size;
+    size_t first = (lo - (char *)mem_heap_lo()) / ALIGNMENT;
+    size_t end, g;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            // size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    if (!((*ranges)->starts[first / 64] >> (first % 64) & 1))
+        return;
+
+    end = payload_end(*ranges, first);
+    (*ranges)->starts[first / 64] &= ~((uint64_t)1 << (first % 64));
+    for (g = first; g < end; g++)
+        (*ranges)->used[g / 64] &= ~((uint64_t)1 << (g % 64));
 }
 
 /*
- * clear_ranges - free all of the range records for a trace
+ * clear_ranges - forget every payload of a trace, allocating the range
+ *     map on first use
  */
 static void clear_ranges(range_t **ranges) {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if (*ranges == NULL) {
+        if ((*ranges = (range_t *)malloc(sizeof(range_t))) == NULL ||
+            ((*ranges)->used = calloc(GRANULE_WORDS, sizeof(uint64_t))) == NULL ||
+            ((*ranges)->starts = calloc(GRANULE_WORDS, sizeof(uint64_t))) == NULL)
+            unix_error("malloc error in clear_ranges");
+        (*ranges)->hi_word = 0;
+        return;
     }
-    *ranges = NULL;
+
+    memset((*ranges)->used, 0, (*ranges)->hi_word * sizeof(uint64_t));
+    memset((*ranges)->starts, 0, (*ranges)->hi_word * sizeof(uint64_t));
+    (*ranges)->hi_word = 0;
 }
 
 
@@ -435,23 +842,28 @@ static void clear_ranges(range_t **ranges) {
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Binary traces
+ *     are mapped instead, and their requests are replayed in place. When
+ *     streaming, only the header is read and the requests are read again
+ *     on every replay.
  */
 static trace_t *read_trace(char *tracedir, char *filename) {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    char magic[TRACEBIN_MAGIC_SIZE];
+    tracebin_header_t header;
+    int binary;
     unsigned max_index = 0;
-    unsigned op_index;
+    int op_index;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
 
     /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trance");
+    trace->name = filename;
 
     /* Read the trace file header */
     strcpy(path, tracedir);
@@ -460,15 +872,68 @@ static trace_t *read_trace(char *tracedir, char *filename) {
         sprintf(msg, "Could not open %s in read_trace", path);
         unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));
-    fscanf(tracefile, "%d", &(trace->num_ops));
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
 
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
+    binary = fread(magic, 1, TRACEBIN_MAGIC_SIZE, tracefile) == TRACEBIN_MAGIC_SIZE &&
+        memcmp(magic, TRACEBIN_MAGIC, TRACEBIN_MAGIC_SIZE) == 0;
+    if (binary && !streaming) {
+        fclose(tracefile);
+        map_trace(trace, path);
+    } else if (binary) {
+        rewind(tracefile);
+        if (fread(&header, sizeof(header), 1, tracefile) != 1)
+            app_error("Binary trace is too short for its header");
+        trace->sugg_heapsize = header.sugg_heapsize; /* not used */
+        trace->num_ids = header.num_ids;
+        trace->num_ops = header.num_ops;
+        trace->weight = header.weight;               /* not used */
+    } else {
+        rewind(tracefile);
+        fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+        fscanf(tracefile, "%d", &(trace->num_ids));
+        fscanf(tracefile, "%d", &(trace->num_ops));
+        fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    }
+
+    /*
+     * A streamed trace keeps its file open and reads the requests in
+     * windows, and only remembers the blocks that are live
+     */
+    if (streaming) {
+        if ((trace->stream = (stream_t *)calloc(1, sizeof(stream_t))) == NULL ||
+            (trace->stream->windows[0] =
+             (traceop_t *)malloc(STREAM_WINDOW * sizeof(traceop_t))) == NULL ||
+            (trace->stream->windows[1] =
+             (traceop_t *)malloc(STREAM_WINDOW * sizeof(traceop_t))) == NULL)
+            unix_error("malloc 2 failed in read_trace");
+        trace->stream->file = tracefile;
+        trace->stream->start = ftell(tracefile);
+        trace->stream->binary = binary;
+        trace->stream->num_ids = trace->num_ids;
+        pthread_mutex_init(&trace->stream->lock, NULL);
+        pthread_cond_init(&trace->stream->changed, NULL);
+        return trace;
+    }
+
+    if (!binary) {
+        /* We'll store each request line in the trace in this array */
+        if ((trace->ops =
+             (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+            unix_error("malloc 2 failed in read_trace");
+
+        /* read every request line in the trace file */
+        op_index = 0;
+        while (op_index < trace->num_ops &&
+               read_op(tracefile, &trace->ops[op_index], path)) {
+            if (trace->ops[op_index].type != FREE &&
+                trace->ops[op_index].type != SIZED_FREE &&
+                (unsigned)trace->ops[op_index].index > max_index)
+                max_index = trace->ops[op_index].index;
+            op_index++;
+        }
+        fclose(tracefile);
+        assert(max_index == trace->num_ids - 1);
+        assert(trace->num_ops == op_index);
+    }
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks =
@@ -480,48 +945,322 @@ static trace_t *read_trace(char *tracedir, char *filename) {
          (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
         unix_error("malloc 4 failed in read_trace");
 
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch (type[0]) {
-        case 'a':
-            fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            fscanf(tracefile, "%ud", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            printf("Bogus type character (%c) in tracefile %s\n",
-                   type[0], path);
-            exit(1);
-        }
-        op_index++;
+    return trace;
+}
+
+/*
+ * read_op - parse the next request line of a text trace into op, in the
+ *     grammar described in tracebin.h. Returns 0 at the end of the file.
+ */
+static int read_op(FILE *tracefile, traceop_t *op, char *path) {
+    char line[MAXLINE];
+    int parsed;
+
+    do {
+        if (fgets(line, MAXLINE, tracefile) == NULL)
+            return 0;
+    } while ((parsed = tracebin_parse(line, (tracebin_op_t *)op)) == 0);
+
+    if (parsed < 0) {
+        printf("Malformed request (%s) in tracefile %s\n",
+               strtok(line, "\n"), path);
+        exit(1);
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
+    return 1;
+}
 
-    return trace;
+/*
+ * map_trace - map a binary trace written by rep2bin. Its records become
+ *     the trace's ops array as they are, so nothing is parsed or copied.
+ */
+static void map_trace(trace_t *trace, char *path) {
+    int fd;
+    struct stat st;
+    tracebin_header_t *header;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        sprintf(msg, "Could not open %s in map_trace", path);
+        unix_error(msg);
+    }
+    if ((size_t)st.st_size < sizeof(tracebin_header_t))
+        app_error("Binary trace is too short for its header");
+
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+        unix_error("mmap failed in map_trace");
+    close(fd);
+
+    header = (tracebin_header_t *)trace->map;
+    trace->sugg_heapsize = header->sugg_heapsize; /* not used */
+    trace->num_ids = header->num_ids;
+    trace->num_ops = header->num_ops;
+    trace->weight = header->weight;               /* not used */
+    if (trace->num_ids <= 0 || trace->num_ops < 0 ||
+        trace->map_size != sizeof(tracebin_header_t) +
+        (size_t)trace->num_ops * sizeof(tracebin_op_t))
+        app_error("Binary trace does not hold the requests its header declares");
+
+    /* The requests are replayed front to back, several times */
+    trace->ops = (traceop_t *)(header + 1);
+    madvise(trace->map, trace->map_size, MADV_SEQUENTIAL);
+    check_records(trace->ops, 0, trace->num_ops, trace->num_ids, path);
+}
+
+/*
+ * check_records - make sure the records of a binary trace hold requests
+ *     a text trace could, since they are replayed without parsing. The
+ *     first of the count records at ops is record first of the trace.
+ */
+static void check_records(traceop_t *ops, int first, int count, int num_ids,
+                          char *path) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!tracebin_valid((tracebin_op_t *)&ops[i]) || ops[i].index >= num_ids) {
+            snprintf(msg, sizeof(msg), "Malformed record %d in binary trace %s",
+                     first + i, path);
+            app_error(msg);
+        }
+    }
 }
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(). The
+ *              requests of a binary trace are unmapped instead, and a
+ *              streamed trace frees its windows and live blocks.
  */
 void free_trace(trace_t *trace) {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->stream != NULL) {
+        fclose(trace->stream->file);
+        pthread_mutex_destroy(&trace->stream->lock);
+        pthread_cond_destroy(&trace->stream->changed);
+        free(trace->stream->windows[0]);
+        free(trace->stream->windows[1]);
+        free(trace->stream);
+        free(trace->live);
+    }
+    if (trace->map != NULL)   /* free the three arrays... */
+        munmap(trace->map, trace->map_size);
+    else
+        free(trace->ops);
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
 }
 
+/*********************************************************************
+ * The following routines hand the evaluators one request at a time and
+ * remember the blocks they allocate, from memory or from a stream
+ ********************************************************************/
+
+/*
+ * open_ops - rewind the trace's requests for another replay. A streamed
+ *     trace starts a reader thread that fills the windows.
+ */
+static void open_ops(trace_t *trace) {
+    stream_t *stream = trace->stream;
+
+    trace->next_op = 0;
+    if (stream == NULL)
+        return;
+
+    /* The blocks of the last replay are gone along with the heap */
+    if (trace->live != NULL)
+        memset(trace->live, 0xff, trace->live_capacity * sizeof(idslot_t));
+    trace->num_live = 0;
+
+    /* The first request waits for window 0 */
+    fseek(stream->file, stream->start, SEEK_SET);
+    stream->filled[0] = stream->filled[1] = 0;
+    stream->counts[0] = stream->counts[1] = 0;
+    stream->current = 0;
+    stream->holding = 0;
+    stream->pos = 0;
+    stream->limit = 0;
+    stream->done = 0;
+    if (pthread_create(&stream->reader, NULL, stream_reader, stream) != 0)
+        unix_error("pthread_create failed in open_ops");
+}
+
+/*
+ * next_op - return the next request of the trace, or NULL after the last
+ */
+static traceop_t *next_op(trace_t *trace) {
+    stream_t *stream = trace->stream;
+
+    if (stream == NULL)
+        return (trace->next_op < trace->num_ops) ? &trace->ops[trace->next_op++] : NULL;
+
+    /* Hand the replayed window back to the reader and wait for the next */
+    if (stream->pos == stream->limit) {
+        pthread_mutex_lock(&stream->lock);
+        if (stream->holding) {
+            stream->filled[stream->current] = 0;
+            pthread_cond_broadcast(&stream->changed);
+            stream->current ^= 1;
+        }
+        stream->holding = 1;
+        while (!stream->filled[stream->current])
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        stream->limit = stream->counts[stream->current];
+        pthread_mutex_unlock(&stream->lock);
+
+        stream->pos = 0;
+        if (stream->limit == 0)
+            return NULL;
+    }
+
+    return &stream->windows[stream->current][stream->pos++];
+}
+
+/*
+ * close_ops - stop the reader thread of a streamed trace
+ */
+static void close_ops(trace_t *trace) {
+    stream_t *stream = trace->stream;
+
+    if (stream == NULL)
+        return;
+
+    pthread_mutex_lock(&stream->lock);
+    stream->done = 1;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->reader, NULL);
+}
+
+/*
+ * stream_reader - fill each window in turn as soon as the replay hands
+ *     it back. A window of 0 requests marks the end of the trace.
+ */
+static void *stream_reader(void *arg) {
+    stream_t *stream = (stream_t *)arg;
+    int window = 0;
+    int count, first;
+
+    for (;;) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->filled[window] && !stream->done)
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        pthread_mutex_unlock(&stream->lock);
+        if (stream->done)
+            return NULL;
+
+        if (stream->binary) {
+            first = (ftell(stream->file) - stream->start) / sizeof(traceop_t);
+            count = fread(stream->windows[window], sizeof(traceop_t),
+                          STREAM_WINDOW, stream->file);
+            check_records(stream->windows[window], first, count,
+                          stream->num_ids, "stream");
+        } else {
+            for (count = 0; count < STREAM_WINDOW; count++)
+                if (!read_op(stream->file, &stream->windows[window][count], "stream"))
+                    break;
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        stream->counts[window] = count;
+        stream->filled[window] = 1;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+
+        if (count == 0)
+            return NULL;
+        window ^= 1;
+    }
+}
+
+/*
+ * find_slot - return the slot of block index in a streamed trace's hash
+ *     table, or the empty slot where it belongs
+ */
+static idslot_t *find_slot(trace_t *trace, int index) {
+    size_t mask = trace->live_capacity - 1;
+    size_t i = ((unsigned)index * 2654435761u) & mask;
+
+    while (trace->live[i].index != -1 && trace->live[i].index != index)
+        i = (i + 1) & mask;
+    return &trace->live[i];
+}
+
+/*
+ * set_block - remember the block allocated for request index
+ */
+static void set_block(trace_t *trace, int index, char *p, size_t size) {
+    idslot_t *slot;
+    idslot_t *old;
+    size_t i, old_capacity;
+
+    if (trace->stream == NULL) {
+        trace->blocks[index] = p;
+        trace->block_sizes[index] = size;
+        return;
+    }
+
+    /* Keep the table at most half full */
+    if (2 * (trace->num_live + 1) > trace->live_capacity) {
+        old = trace->live;
+        old_capacity = trace->live_capacity;
+        trace->live_capacity = (old_capacity == 0) ? 1024 : 2 * old_capacity;
+        if ((trace->live = (idslot_t *)malloc(trace->live_capacity * sizeof(idslot_t))) == NULL)
+            unix_error("malloc failed in set_block");
+        memset(trace->live, 0xff, trace->live_capacity * sizeof(idslot_t));
+        for (i = 0; i < old_capacity; i++)
+            if (old[i].index != -1)
+                *find_slot(trace, old[i].index) = old[i];
+        free(old);
+    }
+
+    slot = find_slot(trace, index);
+    if (slot->index == -1)
+        trace->num_live++;
+    slot->index = index;
+    slot->block = p;
+    slot->size = size;
+}
+
+/*
+ * take_block - return the block allocated for request index and its
+ *     size, which a streamed trace then forgets
+ */
+static char *take_block(trace_t *trace, int index, size_t *size) {
+    idslot_t *slot, *hole;
+    char *p;
+    size_t mask, home;
+
+    if (trace->stream == NULL) {
+        *size = trace->block_sizes[index];
+        return trace->blocks[index];
+    }
+
+    slot = find_slot(trace, index);
+    if (slot->index == -1)
+        app_error("Trace frees a block it never allocated");
+    p = slot->block;
+    *size = slot->size;
+
+    /* Shift later entries of the probe chain back into the hole */
+    mask = trace->live_capacity - 1;
+    hole = slot;
+    for (;;) {
+        slot = &trace->live[((slot - trace->live) + 1) & mask];
+        if (slot->index == -1)
+            break;
+        home = ((unsigned)slot->index * 2654435761u) & mask;
+        if ((((slot - trace->live) - home) & mask) >=
+            (((slot - trace->live) - (hole - trace->live)) & mask)) {
+            *hole = *slot;
+            hole = slot;
+        }
+    }
+    hole->index = -1;
+    trace->num_live--;
+
+    return p;
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
@@ -531,12 +1270,14 @@ void free_trace(trace_t *trace) {
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
-    int i;
+    int i, j;
     int index;
     int size;
-    char *p;
+    size_t old_size;
+    char *p, *newp;
+    traceop_t *op;
 
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and forget every payload in the range map */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -547,26 +1288,51 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-        index = trace->ops[i].index;
-        size = trace->ops[i].size;
+    open_ops(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+        index = op->index;
+        size = op->size;
 
-        switch (trace->ops[i].type) {
-        case ALLOC: /* mm_malloc */
+        switch (op->type) {
+        case ALLOC:    /* mm_malloc */
+        case CALLOC:   /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
-                malloc_error(tracenum, i, "mm_malloc failed.");
+            if ((p = mm_alloc_op(op)) == NULL) {
+                sprintf(msg, "mm_%s failed.", op_names[op->type]);
+                malloc_error(tracenum, i, msg);
+                close_ops(trace);
                 return 0;
             }
 
             /*
              * Test the range of the new block for correctness and add it
-             * to the range list if OK. The block must be  be aligned properly,
+             * to the range map if OK. The block must be  be aligned properly,
              * and must not overlap any currently allocated block.
              */
-            if (add_range(ranges, p, size, tracenum, i) == 0)
+            if (add_range(ranges, p, size, tracenum, i) == 0) {
+                close_ops(trace);
+                return 0;
+            }
+
+            /* calloc's block must be zeroed, and memalign's aligned */
+            if (op->type == CALLOC) {
+                for (j = 0; j < size && p[j] == 0; j++)
+                    ;
+                if (j < size) {
+                    malloc_error(tracenum, i, "mm_calloc did not zero the block");
+                    close_ops(trace);
+                    return 0;
+                }
+            }
+            if (op->type == MEMALIGN && (size_t)p % op->arg != 0) {
+                sprintf(msg, "mm_memalign block (%p) not aligned to %d bytes",
+                        p, op->arg);
+                malloc_error(tracenum, i, msg);
+                close_ops(trace);
                 return 0;
+            }
 
             /* ADDED: cgw
              * fill range with low byte of index.  This will be used later
@@ -576,14 +1342,56 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
             memset(p, index & 0xFF, size);
 
             /* Remember region */
-            trace->blocks[index] = p;
-            trace->block_sizes[index] = size;
+            set_block(trace, index, p, size);
+            break;
+
+        case REALLOC: /* mm_realloc */
+
+            /* Call the student's realloc */
+            p = take_block(trace, index, &old_size);
+            if ((newp = mm_realloc(p, size)) == NULL) {
+                malloc_error(tracenum, i, "mm_realloc failed.");
+                close_ops(trace);
+                return 0;
+            }
+
+            /* Remove the old region from the range map */
+            remove_range(ranges, p);
+
+            /* Check new block for correctness and add it to range map */
+            if (add_range(ranges, newp, size, tracenum, i) == 0) {
+                close_ops(trace);
+                return 0;
+            }
+
+            /* ADDED: cgw
+             * Make sure that the new block contains the data from the old
+             * block and then fill in the new block with the low order byte
+             * of the new index
+             */
+            if ((size_t)size < old_size)
+                old_size = size;
+            for (j = 0; j < old_size; j++) {
+                if (newp[j] != (char)(index & 0xFF)) {
+                    malloc_error(tracenum, i, "mm_realloc did not preserve the "
+                                 "data from old block");
+                    close_ops(trace);
+                    return 0;
+                }
+            }
+            memset(newp, index & 0xFF, size);
+
+            /* Remember region */
+            set_block(trace, index, newp, size);
             break;
 
-        case FREE: /* mm_free */
+        case FREE:       /* mm_free */
+        case SIZED_FREE: /* mm_free of a block whose size is known */
 
-            /* Remove region from list and call student's free function */
-            p = trace->blocks[index];
+            /* Remove region from the map and call student's free function */
+            p = take_block(trace, index, &old_size);
+            if (op->type == SIZED_FREE && old_size != (size_t)size)
+                app_error("Trace frees a block with the wrong size");
             remove_range(ranges, p);
             mm_free(p);
             break;
@@ -592,6 +1400,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
             app_error("Nonexistent request type in eval_mm_valid");
         }
     }
+    close_ops(trace);
 
     /* As far as we know, this is a valid malloc package */
     //examine_heap();
@@ -606,33 +1415,36 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
  *   size of the heap in bytes after running the student's malloc
  *   package on the trace. Note that our implementation of mem_sbrk()
  *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   is always the high water mark of the heap. With -u, the heap is
+ *   also sampled as the trace goes, to show when fragmentation builds.
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
-    int i;
-    int index;
-    int size;
-    int max_total_size = 0;
-    int total_size = 0;
+    int index, opnum = 0;
+    size_t size, old_size;
+    size_t max_total_size = 0;
+    size_t total_size = 0;
     char *p;
+    traceop_t *op;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* mm_alloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+    open_ops(trace);
+    while ((op = next_op(trace)) != NULL) {
+        switch (op->type) {
+        case ALLOC:    /* mm_alloc */
+        case CALLOC:   /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
+            index = op->index;
+            size = op->size;
 
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm_alloc_op(op)) == NULL)
                 app_error("mm_malloc failed in eval_mm_util");
 
             /* Remember region and size */
-            trace->blocks[index] = p;
-            trace->block_sizes[index] = size;
+            set_block(trace, index, p, size);
 
             /* Keep track of current total size
              * of all allocated blocks */
@@ -643,10 +1455,30 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
                 total_size : max_total_size;
             break;
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            size = trace->block_sizes[index];
-            p = trace->blocks[index];
+        case REALLOC: /* mm_realloc */
+            index = op->index;
+            size = op->size;
+            p = take_block(trace, index, &old_size);
+
+            if ((p = mm_realloc(p, size)) == NULL)
+                app_error("mm_realloc failed in eval_mm_util");
+
+            /* Remember region and size */
+            set_block(trace, index, p, size);
+
+            /* Keep track of current total size
+             * of all allocated blocks */
+            total_size += size - old_size;
+
+            /* Update statistics */
+            max_total_size = (total_size > max_total_size) ?
+                total_size : max_total_size;
+            break;
+
+        case FREE:       /* mm_free */
+        case SIZED_FREE:
+            index = op->index;
+            p = take_block(trace, index, &size);
 
             mm_free(p);
 
@@ -659,46 +1491,123 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
         default:
             app_error("Nonexistent request type in eval_mm_util");
         }
+
+        if (timeline != NULL && ++opnum % timeline_interval == 0)
+            sample_heap(trace, opnum, total_size);
     }
+    close_ops(trace);
+    if (timeline != NULL && opnum % timeline_interval != 0)
+        sample_heap(trace, opnum, total_size);
 
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
+/*
+ * sample_heap - write one row of the utilization timeline, after the
+ *     first opnum requests of a trace left live_bytes of payload live
+ */
+static void sample_heap(trace_t *trace, int opnum, size_t live_bytes) {
+    HeapStats heap;
+    size_t heap_bytes = mem_heapsize();
+
+    mm_heap_stats(&heap);
+    fprintf(timeline, "%s,%d,%zu,%zu,%zu,%zu,%zu,%.4f\n",
+            trace->name, opnum, live_bytes, heap_bytes, heap.free_bytes,
+            heap.largest_free, heap.free_blocks,
+            (heap_bytes > 0) ? (double)live_bytes / heap_bytes : 0);
+}
+
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr) {
-    int i, index, size;
-    char *p, *block;
+    int index, size;
+    size_t old_size;
+    char *p = NULL, *block;
+    traceop_t *op;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    lathist_t *latency = ((speed_t *)ptr)->latency;
+    touch_t *touch = ((speed_t *)ptr)->touch;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_speed");
+    if (touch != NULL)
+        touch_reset(touch);
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    open_ops(trace);
+    while ((op = next_op(trace)) != NULL) {
+        switch (op->type) {
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            index = op->index;
+            size = op->size;
+            TIMED(latency, ALLOC, p = mm_malloc(size));
+            if (p == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
+            set_block(trace, index, p, size);
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = op->index;
+            size = op->size;
+            TIMED(latency, CALLOC, p = mm_calloc(op->arg, size / op->arg));
+            if (p == NULL)
+                app_error("mm_calloc error in eval_mm_speed");
+            set_block(trace, index, p, size);
             break;
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
+        case MEMALIGN: /* mm_memalign */
+            index = op->index;
+            size = op->size;
+            TIMED(latency, MEMALIGN, p = mm_memalign(op->arg, size));
+            if (p == NULL)
+                app_error("mm_memalign error in eval_mm_speed");
+            set_block(trace, index, p, size);
+            break;
+
+        case REALLOC: /* mm_realloc */
+            index = op->index;
+            size = op->size;
+            block = take_block(trace, index, &old_size);
+            TIMED(latency, REALLOC, p = mm_realloc(block, size));
+            if (p == NULL)
+                app_error("mm_realloc error in eval_mm_speed");
+            set_block(trace, index, p, size);
+            break;
+
+        case FREE:       /* mm_free */
+        case SIZED_FREE:
+            index = op->index;
+            block = take_block(trace, index, &old_size);
+            TIMED(latency, op->type, mm_free(block));
             break;
 
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
+
+        if (touch != NULL)
+            touch_op(touch, op, p);
+    }
+    close_ops(trace);
+}
+
+/*
+ * mm_alloc_op - make an allocation request of any kind with the mm package
+ */
+static char *mm_alloc_op(traceop_t *op) {
+    switch (op->type) {
+    case CALLOC:
+        return mm_calloc(op->arg, op->size / op->arg);
+    case MEMALIGN:
+        return mm_memalign(op->arg, op->size);
+    default:
+        return mm_malloc(op->size);
+    }
 }
 
 /*
@@ -709,25 +1618,41 @@ static void eval_mm_speed(void *ptr) {
  */
 static int eval_libc_valid(trace_t *trace, int tracenum) {
     int i;
+    size_t size;
     char *p;
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
+    traceop_t *op;
+
+    open_ops(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+        switch (op->type) {
+        case ALLOC:    /* malloc */
+        case CALLOC:   /* calloc */
+        case MEMALIGN: /* posix_memalign */
+            if ((p = libc_alloc_op(op)) == NULL) {
                 malloc_error(tracenum, i, "libc malloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = p;
+            set_block(trace, op->index, p, op->size);
+            break;
+
+        case REALLOC: /* realloc */
+            p = take_block(trace, op->index, &size);
+            if ((p = realloc(p, op->size)) == NULL) {
+                malloc_error(tracenum, i, "libc realloc failed");
+                unix_error("System message");
+            }
+            set_block(trace, op->index, p, op->size);
             break;
 
-        case FREE: /* free */
-           free(trace->blocks[trace->ops[i].index]);
+        case FREE:       /* free */
+        case SIZED_FREE:
+           free(take_block(trace, op->index, &size));
            break;
                 default:
             app_error("invalid operation type  in eval_libc_valid");
         }
     }
+    close_ops(trace);
 
     return 1;
 }
@@ -738,28 +1663,439 @@ static int eval_libc_valid(trace_t *trace, int tracenum) {
  *    of traces.
  */
 static void eval_libc_speed(void *ptr) {
-    int i;
     int index, size;
-    char *p, *block;
+    size_t old_size;
+    char *p = NULL, *block;
+    traceop_t *op;
     trace_t *trace = ((speed_t *)ptr)->trace;
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = malloc(size)) == NULL)
+    touch_t *touch = ((speed_t *)ptr)->touch;
+
+    if (touch != NULL)
+        touch_reset(touch);
+    open_ops(trace);
+    while ((op = next_op(trace)) != NULL) {
+        switch (op->type) {
+        case ALLOC:    /* malloc */
+        case CALLOC:   /* calloc */
+        case MEMALIGN: /* posix_memalign */
+            index = op->index;
+            size = op->size;
+            if ((p = libc_alloc_op(op)) == NULL)
                 unix_error("malloc failed in eval_libc_speed");
-            trace->blocks[index] = p;
+            set_block(trace, index, p, size);
+            break;
+
+        case REALLOC: /* realloc */
+            index = op->index;
+            size = op->size;
+            block = take_block(trace, index, &old_size);
+            if ((p = realloc(block, size)) == NULL)
+                unix_error("realloc failed in eval_libc_speed");
+            set_block(trace, index, p, size);
             break;
 
-        case FREE: /* free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
+        case FREE:       /* free */
+        case SIZED_FREE:
+            index = op->index;
+            block = take_block(trace, index, &old_size);
             free(block);
             break;
+
+        default:
+            app_error("Nonexistent request type in eval_libc_speed");
+        }
+
+        if (touch != NULL)
+            touch_op(touch, op, p);
+    }
+    close_ops(trace);
+}
+
+/*
+ * libc_alloc_op - make an allocation request of any kind with libc
+ */
+static char *libc_alloc_op(traceop_t *op) {
+    void *p;
+
+    switch (op->type) {
+    case CALLOC:
+        return calloc(op->arg, op->size / op->arg);
+    case MEMALIGN:
+        /* posix_memalign takes nothing finer than a pointer */
+        if (posix_memalign(&p, (op->arg < (int)sizeof(void *)) ? sizeof(void *) : op->arg,
+                           op->size) != 0)
+            return NULL;
+        return p;
+    default:
+        return malloc(op->size);
+    }
+}
+
+/*********************************************************************
+ * The following routines touch the payloads of a replay the way an
+ * application would, so that allocators get credit for good locality
+ ********************************************************************/
+
+/*
+ * touch_open - allocate the live set of a trace's touching replays, and
+ *     find the least time two back-to-back clock reads take
+ */
+static void touch_open(touch_t *touch, trace_t *trace) {
+    struct timespec start, end;
+    double secs;
+    int i;
+
+    if ((touch->blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL ||
+        (touch->sizes = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL ||
+        (touch->ids = (int *)malloc(trace->num_ids * sizeof(int))) == NULL ||
+        (touch->slots = (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+        unix_error("malloc failed in touch_open");
+    touch->secs = 0;
+    touch->replays = 0;
+
+    touch->clock_secs = 1;
+    for (i = 0; i < TOUCH_CLOCK_READS; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (secs < touch->clock_secs)
+            touch->clock_secs = secs;
+    }
+}
+
+/*
+ * touch_reset - forget the live payloads, and re-read the same ones in
+ *     every replay
+ */
+static void touch_reset(touch_t *touch) {
+    touch->num_live = 0;
+    touch->requests = 0;
+    touch->seed = 1;
+    touch->replays++;
+}
+
+/*
+ * touch_op - after request op, which returned p, write a new payload
+ *     and forget a freed one. Every touch_every requests, re-read every
+ *     cache line of touch_blocks random live payloads. The time it takes,
+ *     less what reading the clock does, is added to touch->secs.
+ */
+static void touch_op(touch_t *touch, traceop_t *op, char *p) {
+    int slot, last, i;
+    size_t j;
+    char sum = 0;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* A freed or moved payload leaves the live set */
+    if (op->type == FREE || op->type == SIZED_FREE || op->type == REALLOC) {
+        slot = touch->slots[op->index];
+        last = --touch->num_live;
+        touch->blocks[slot] = touch->blocks[last];
+        touch->sizes[slot] = touch->sizes[last];
+        touch->ids[slot] = touch->ids[last];
+        touch->slots[touch->ids[slot]] = slot;
+    }
+
+    /* A new one is written whole, as it would be initialized */
+    if (op->type != FREE && op->type != SIZED_FREE) {
+        memset(p, op->index, op->size);
+        slot = touch->num_live++;
+        touch->blocks[slot] = p;
+        touch->sizes[slot] = op->size;
+        touch->ids[slot] = op->index;
+        touch->slots[op->index] = slot;
+    }
+
+    if (touch_every > 0 && ++touch->requests >= touch_every) {
+        touch->requests = 0;
+        for (i = 0; i < touch_blocks && touch->num_live > 0; i++) {
+            touch->seed ^= touch->seed << 13;
+            touch->seed ^= touch->seed >> 7;
+            touch->seed ^= touch->seed << 17;
+            slot = touch->seed % touch->num_live;
+            for (j = 0; j < touch->sizes[slot]; j += TOUCH_STRIDE)
+                sum += touch->blocks[slot][j];
+        }
+        touch->sink = sum;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    touch->secs += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9 -
+        touch->clock_secs;
+}
+
+/*
+ * touch_close - free the live set
+ */
+static void touch_close(touch_t *touch) {
+    free(touch->blocks);
+    free(touch->sizes);
+    free(touch->ids);
+    free(touch->slots);
+}
+
+/*********************************************************************
+ * The following routines replay a trace on several threads at once to
+ * measure how the libc and mm malloc packages scale
+ ********************************************************************/
+
+/*
+ * eval_scaling - replay a trace on 1, 2, 4... up to max_threads threads
+ *     at once, and print the throughput and tail latency at each count.
+ *     Every thread replays a copy of the trace, or with -P the requests
+ *     of the recorded threads it stands for. A block freed by another
+ *     thread than the one that allocated it is then freed in the same
+ *     order as recorded.
+ */
+static void eval_scaling(trace_t *trace, int tracenum, int mm, stats_t *stats) {
+    scaling_t scale;
+    replayer_t *replayers, *r;
+    lathist_t all;
+    double secs, ops, worst, kops, base_kops = 0;
+    char metric[32];
+    int *counts;
+    int threads, next, t, i, run;
+
+    memset(&scale, 0, sizeof(scale));
+    scale.trace = trace;
+    scale.mm = mm;
+    if ((replayers = (replayer_t *)calloc(max_threads, sizeof(replayer_t))) == NULL)
+        unix_error("calloc failed in eval_scaling");
+
+    if (partitioning) {
+        /* Number the requests on each block in trace order */
+        if ((scale.turns = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+            (scale.done = (int *)malloc(trace->num_ids * sizeof(int))) == NULL ||
+            (scale.blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL ||
+            (scale.block_sizes = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL ||
+            (counts = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+            unix_error("malloc failed in eval_scaling");
+        for (i = 0; i < trace->num_ops; i++)
+            scale.turns[i] = counts[trace->ops[i].index]++;
+        free(counts);
+    }
+    for (t = 0; t < max_threads; t++) {
+        r = &replayers[t];
+        r->scale = &scale;
+        if (partitioning) {
+            if ((r->ops = (int *)malloc(trace->num_ops * sizeof(int))) == NULL)
+                unix_error("malloc failed in eval_scaling");
+            r->blocks = scale.blocks;
+            r->block_sizes = scale.block_sizes;
+        } else if ((r->blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL ||
+                   (r->block_sizes = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+            unix_error("malloc failed in eval_scaling");
+    }
+
+    printf("\nScaling of %s malloc on trace %d, %s:\n", mm ? "mm" : "libc", tracenum,
+           partitioning ? "partitioned by thread" : "a copy per thread");
+    printf("%7s%10s%10s%10s%9s%10s%11s%10s%11s\n",
+           "threads", "ops", "secs", "Kops", "speedup", "p99", "worst p99", "p99.9", "max");
+
+    for (threads = 1; threads <= max_threads; threads = next) {
+        next = (threads < max_threads && 2 * threads > max_threads) ? max_threads : 2 * threads;
+
+        /* Deal the requests out by recorded thread */
+        if (partitioning) {
+            for (t = 0; t < threads; t++)
+                replayers[t].num_ops = 0;
+            for (i = 0; i < trace->num_ops; i++) {
+                r = &replayers[(unsigned)trace->ops[i].tid % threads];
+                r->ops[r->num_ops++] = i;
+            }
+        }
+
+        /* Copies need a heap each, and the simulated heap has a fixed size */
+        if (mm && !partitioning && threads > 1 &&
+            (double)threads * scale.heap * 1.25 > MAX_HEAP) {
+            printf("%7d  (skipped: %d copies would not fit in the heap)\n",
+                   threads, threads);
+            continue;
+        }
+
+        ops = partitioning ? trace->num_ops : (double)threads * trace->num_ops;
+        secs = 0;
+        for (t = 0; t < threads; t++)
+            lathist_reset(&replayers[t].total);
+        for (run = 0; run < num_runs; run++) {
+            double run_secs = run_replay(&scale, replayers, threads, 0);
+
+            if (mm && threads == 1)
+                scale.heap = mem_heapsize();
+            secs += run_secs / num_runs;
+            sprintf(metric, "t%d_secs", threads);
+            record_sample(stats, metric, run, run_secs);
+
+            /* Time every request in a run of its own */
+            run_replay(&scale, replayers, threads, 1);
+            lathist_reset(&all);
+            worst = 0;
+            for (t = 0; t < threads; t++) {
+                r = &replayers[t];
+                lathist_merge(&all, &r->latency);
+                lathist_merge(&r->total, &r->latency);
+                if (r->latency.count > 0 && lathist_percentile(&r->latency, 0.99) > worst)
+                    worst = lathist_percentile(&r->latency, 0.99);
+            }
+            sprintf(metric, "t%d_p99", threads);
+            record_sample(stats, metric, run, lathist_percentile(&all, 0.99));
+            sprintf(metric, "t%d_worst_p99", threads);
+            record_sample(stats, metric, run, worst);
+        }
+
+        /* Summarize every run */
+        lathist_reset(&all);
+        worst = 0;
+        for (t = 0; t < threads; t++) {
+            r = &replayers[t];
+            lathist_merge(&all, &r->total);
+            if (r->total.count > 0 && lathist_percentile(&r->total, 0.99) > worst)
+                worst = lathist_percentile(&r->total, 0.99);
+        }
+        kops = ops / 1e3 / secs;
+        if (threads == 1)
+            base_kops = kops;
+        printf("%7d%10.0f%10.6f%10.0f%8.2fx%10llu%11.0f%10llu%11llu\n",
+               threads, ops, secs, kops, kops / base_kops,
+               (unsigned long long)lathist_percentile(&all, 0.99), worst,
+               (unsigned long long)lathist_percentile(&all, 0.999),
+               (unsigned long long)all.max);
+    }
+
+    for (t = 0; t < max_threads; t++) {
+        if (partitioning) {
+            free(replayers[t].ops);
+        } else {
+            free(replayers[t].blocks);
+            free(replayers[t].block_sizes);
+        }
+    }
+    free(replayers);
+    free(scale.turns);
+    free(scale.done);
+    free(scale.blocks);
+    free(scale.block_sizes);
+}
+
+/*
+ * run_replay - replay a trace once on the first threads replayers, and
+ *     return the seconds from when the first one started until the last
+ *     one finished
+ */
+static double run_replay(scaling_t *scale, replayer_t *replayers, int threads,
+                         int timed) {
+    double start = DBL_MAX, end = 0, t_start, t_end;
+    int t;
+
+    if (scale->mm) {
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in run_replay");
+    }
+    if (scale->done != NULL)
+        memset(scale->done, 0, scale->trace->num_ids * sizeof(int));
+
+    if (pthread_barrier_init(&scale->start, NULL, threads + 1) != 0)
+        unix_error("pthread_barrier_init failed in run_replay");
+    for (t = 0; t < threads; t++) {
+        replayers[t].timed = timed;
+        lathist_reset(&replayers[t].latency);
+        if (pthread_create(&replayers[t].thread, NULL, replay_thread, &replayers[t]) != 0)
+            unix_error("pthread_create failed in run_replay");
+    }
+
+    /* The threads time themselves, as they may run before this one does */
+    pthread_barrier_wait(&scale->start);
+    for (t = 0; t < threads; t++) {
+        pthread_join(replayers[t].thread, NULL);
+        t_start = replayers[t].start.tv_sec + replayers[t].start.tv_nsec / 1e9;
+        t_end = replayers[t].end.tv_sec + replayers[t].end.tv_nsec / 1e9;
+        start = (t_start < start) ? t_start : start;
+        end = (t_end > end) ? t_end : end;
+    }
+    pthread_barrier_destroy(&scale->start);
+
+    return end - start;
+}
+
+/*
+ * replay_thread - make one thread's requests. In a partitioned trace,
+ *     each request first waits for the requests recorded before it on
+ *     the same block, which other threads may make.
+ */
+static void *replay_thread(void *arg) {
+    replayer_t *r = (replayer_t *)arg;
+    scaling_t *scale = r->scale;
+    traceop_t *ops = scale->trace->ops;
+    int i, turn;
+    int *done;
+
+    pthread_barrier_wait(&scale->start);
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+
+    if (r->ops == NULL) {
+        for (i = 0; i < scale->trace->num_ops; i++)
+            replay_request(r, &ops[i]);
+    } else {
+        for (i = 0; i < r->num_ops; i++) {
+            turn = scale->turns[r->ops[i]];
+            done = &scale->done[ops[r->ops[i]].index];
+            while (__atomic_load_n(done, __ATOMIC_ACQUIRE) != turn)
+                sched_yield();
+            replay_request(r, &ops[r->ops[i]]);
+            __atomic_store_n(done, turn + 1, __ATOMIC_RELEASE);
         }
     }
+
+    clock_gettime(CLOCK_MONOTONIC, &r->end);
+    return NULL;
+}
+
+/*
+ * replay_request - make one request of a thread's replay, timing it
+ *     along with any wait for mm_lock if asked to
+ */
+static void replay_request(replayer_t *r, traceop_t *op) {
+    int index = op->index;
+    int mm = r->scale->mm;
+    char *p = NULL;
+
+    if (r->timed)
+        start_counter();
+    if (mm)
+        pthread_mutex_lock(&mm_lock);
+
+    switch (op->type) {
+    case ALLOC:
+    case CALLOC:
+    case MEMALIGN:
+        p = mm ? mm_alloc_op(op) : libc_alloc_op(op);
+        break;
+
+    case REALLOC:
+        p = mm ? mm_realloc(r->blocks[index], op->size) : realloc(r->blocks[index], op->size);
+        break;
+
+    default: /* FREE and SIZED_FREE */
+        if (mm)
+            mm_free(r->blocks[index]);
+        else
+            free(r->blocks[index]);
+    }
+
+    if (mm)
+        pthread_mutex_unlock(&mm_lock);
+    if (r->timed)
+        lathist_record(&r->latency, (uint64_t)get_counter());
+
+    if (op->type != FREE && op->type != SIZED_FREE) {
+        if (p == NULL)
+            app_error("An allocation failed in replay_request");
+        r->blocks[index] = p;
+        r->block_sizes[index] = op->size;
+    }
 }
 
 /*************************************
@@ -767,59 +2103,440 @@ static void eval_libc_speed(void *ptr) {
  ************************************/
 
 
+/*
+ * measure_trace - time num_runs runs of a trace. With each one, time
+ *     every request in a separate run if asked to (mm only, so that
+ *     reading the counter does not skew the throughput), and count
+ *     hardware events in another with -c. With -a, the runs are repeated
+ *     touching the payloads, and the application's share is the time
+ *     spent in the touches themselves; its hardware events are what the
+ *     touching run adds. Every run's numbers are kept as samples.
+ */
+static void measure_trace(fsecs_test_funct f, speed_t *params, stats_t *stats,
+                          int time_requests) {
+    lathist_t latency[NUM_OP_TYPES];
+    double secs, app, counters[NUM_PERFCTRS], touched[NUM_PERFCTRS];
+    char metric[32];
+    int run, type, j;
+    touch_t touch;
+
+    stats->secs = 0;
+    stats->app_secs = 0;
+    for (j = 0; j < NUM_PERFCTRS; j++)
+        stats->counters[j] = stats->app_counters[j] = 0;
+    if (touching)
+        touch_open(&touch, params->trace);
+
+    for (run = 0; run < num_runs; run++) {
+        secs = fsecs(f, params);
+        stats->secs += secs / num_runs;
+        record_sample(stats, "secs", run, secs);
+
+        if (touching) {
+            touch.secs = 0;
+            touch.replays = 0;
+            params->touch = &touch;
+            fsecs(f, params);
+            params->touch = NULL;
+            app = (touch.secs > 0) ? touch.secs / touch.replays : 0;
+            stats->app_secs += app / num_runs;
+            record_sample(stats, "app_secs", run, app);
+        }
+
+        if (time_requests) {
+            if (stats->latency == NULL &&
+                (stats->latency = calloc(NUM_OP_TYPES, sizeof(lathist_t))) == NULL)
+                unix_error("latency calloc in measure_trace failed");
+            for (type = 0; type < NUM_OP_TYPES; type++)
+                lathist_reset(&latency[type]);
+            params->latency = latency;
+            f(params);
+            params->latency = NULL;
+
+            for (type = 0; type < NUM_OP_TYPES; type++) {
+                if (latency[type].count == 0)
+                    continue;
+                lathist_merge(&stats->latency[type], &latency[type]);
+                for (j = 0; j < NUM_LAT_PERCENTILES; j++) {
+                    sprintf(metric, "%s_%s", op_names[type], lat_percentile_names[j]);
+                    record_sample(stats, metric, run,
+                                  lathist_percentile(&latency[type], lat_percentiles[j]));
+                }
+                sprintf(metric, "%s_max", op_names[type]);
+                record_sample(stats, metric, run, latency[type].max);
+            }
+        }
+
+        if (counting) {
+            count_events(f, params, counters);
+            for (j = 0; j < NUM_PERFCTRS; j++) {
+                if (counters[j] < 0 || stats->counters[j] < 0) {
+                    stats->counters[j] = -1;
+                    continue;
+                }
+                stats->counters[j] += counters[j] / num_runs;
+                sprintf(metric, "%s_per_op", perfctr_names[j]);
+                record_sample(stats, metric, run, counters[j] / stats->ops);
+            }
+
+            if (touching) {
+                params->touch = &touch;
+                count_events(f, params, touched);
+                params->touch = NULL;
+                for (j = 0; j < NUM_PERFCTRS; j++) {
+                    if (stats->counters[j] < 0 || touched[j] < 0) {
+                        stats->app_counters[j] = -1;
+                        continue;
+                    }
+                    stats->app_counters[j] += (touched[j] - counters[j]) / num_runs;
+                    sprintf(metric, "app_%s_per_op", perfctr_names[j]);
+                    record_sample(stats, metric, run, (touched[j] - counters[j]) / stats->ops);
+                }
+            }
+        }
+    }
+
+    if (touching)
+        touch_close(&touch);
+}
+
+/*
+ * profile_phases - if mm.c was built with PROFILE, replay a trace once
+ *     more and keep what its phases counted, next to the cycles of the
+ *     whole replay
+ */
+static void profile_phases(speed_t *params, stats_t *stats) {
+    char metric[32];
+    int phase;
+
+    if (!mm_profile(stats->profile))
+        return;
+
+    mm_profile_reset();
+    start_counter();
+    eval_mm_speed(params);
+    stats->profile_cycles = get_counter();
+    mm_profile(stats->profile);
+    stats->profiled = 1;
+
+    for (phase = 0; phase < PROFILE_NUM_PHASES; phase++) {
+        sprintf(metric, "%s_cycles", phase_names[phase]);
+        record_sample(stats, metric, 0, stats->profile[phase].cycles);
+    }
+}
+
+/*
+ * collect_sites - keep the call sites mm sampled in a trace, heaviest
+ *     first, and stop sampling
+ */
+static void collect_sites(stats_t *stats) {
+    if ((stats->sites = calloc(HEAP_SAMPLE_SITES, sizeof(HeapSite))) == NULL)
+        unix_error("sites calloc in collect_sites failed");
+    stats->num_sites = mm_heap_sites(stats->sites, HEAP_SAMPLE_SITES);
+    qsort(stats->sites, stats->num_sites, sizeof(HeapSite), compare_sites);
+    mm_sample_heap(0);
+}
+
+/*
+ * compare_sites - order call sites by the bytes they allocated, most first
+ */
+static int compare_sites(const void *a, const void *b) {
+    const HeapSite *x = a, *y = b;
+
+    return (x->total_bytes < y->total_bytes) - (x->total_bytes > y->total_bytes);
+}
+
+/*
+ * count_events - count the hardware events of one more run of a trace
+ */
+static void count_events(fsecs_test_funct f, speed_t *params, double *counters) {
+    perfctr_start(&perfctrs);
+    f(params);
+    perfctr_stop(&perfctrs, counters);
+}
+
+/*
+ * record_sample - keep one measurement for the results file
+ */
+static void record_sample(stats_t *stats, char *metric, int run, double value) {
+    sample_t *sample;
+
+    stats->samples = realloc(stats->samples, (stats->num_samples + 1) * sizeof(sample_t));
+    if (stats->samples == NULL)
+        unix_error("realloc failed in record_sample");
+    sample = &stats->samples[stats->num_samples++];
+    strncpy(sample->metric, metric, sizeof(sample->metric) - 1);
+    sample->metric[sizeof(sample->metric) - 1] = '\0';
+    sample->run = run;
+    sample->value = value;
+}
+
+/*
+ * write_results - write every trace's samples to path, as CSV rows of
+ *     allocator,trace,metric,run,value if it ends in .csv and as JSON
+ *     otherwise. mdcompare reads the CSV form.
+ */
+static void write_results(char *path, int n, char **tracefiles,
+                          stats_t *libc_stats, stats_t *mm_stats, double perfindex) {
+    FILE *fp;
+    char *names[2] = {"libc", "mm"};
+    stats_t *all[2];
+    size_t len = strlen(path);
+    int csv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+    int a, i, j, first = 1;
+
+    all[0] = libc_stats;
+    all[1] = mm_stats;
+    if ((fp = fopen(path, "w")) == NULL)
+        unix_error("Could not open the results file");
+
+    if (csv)
+        fprintf(fp, "allocator,trace,metric,run,value\n");
+    else
+        fprintf(fp, "{\n  \"runs\": %d,\n  \"perfindex\": %.1f,\n  \"results\": [",
+                num_runs, perfindex);
+
+    for (a = 0; a < 2; a++) {
+        for (i = 0; all[a] != NULL && i < n; i++) {
+            stats_t *stats = &all[a][i];
+
+            if (csv) {
+                /* An invalid trace has no other rows, so say why */
+                fprintf(fp, "%s,%s,valid,0,%d\n", names[a], tracefiles[i],
+                        stats->valid);
+                for (j = 0; j < stats->num_samples; j++)
+                    fprintf(fp, "%s,%s,%s,%d,%.9g\n", names[a], tracefiles[i],
+                            stats->samples[j].metric, stats->samples[j].run,
+                            stats->samples[j].value);
+                continue;
+            }
+
+            /* One array per metric, holding its samples in run order */
+            fprintf(fp, "%s\n    {\"allocator\": \"%s\", \"trace\": \"%s\", "
+                    "\"valid\": %s, \"ops\": %.0f, \"samples\": {",
+                    first ? "" : ",", names[a], tracefiles[i],
+                    stats->valid ? "true" : "false", stats->ops);
+            first = 0;
+            for (j = 0; j < stats->num_samples; j++) {
+                sample_t *s = &stats->samples[j];
+                int k, opened = 0;
+
+                /* Start a metric at its first sample */
+                for (k = 0; k < j; k++)
+                    if (strcmp(stats->samples[k].metric, s->metric) == 0)
+                        opened = 1;
+                if (opened)
+                    continue;
+                fprintf(fp, "%s\"%s\": [", (j > 0) ? ", " : "", s->metric);
+                for (k = j; k < stats->num_samples; k++)
+                    if (strcmp(stats->samples[k].metric, s->metric) == 0)
+                        fprintf(fp, "%s%.9g", (k > j) ? ", " : "", stats->samples[k].value);
+                fprintf(fp, "]");
+            }
+            fprintf(fp, "}}");
+        }
+    }
+
+    if (!csv)
+        fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
 static void printresults(int n, stats_t *stats) {
-    int i;
+    int i, j;
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double counters[NUM_PERFCTRS] = {0};
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%8s\n",
+    printf("%5s%7s %5s%8s%10s%8s",
            "trace", " valid", "util", "ops", "secs", "Kops");
+    for (j = 0; counting && j < NUM_PERFCTRS; j++)
+        printf("%8s", perfctr_names[j]);
+    printf("\n");
     for (i = 0; i < n; i++) {
         if (stats[i].valid) {
-            printf("%2d%10s%5.0f%%%8.0f%10.6f%8.0f\n",
+            printf("%2d%10s%5.0f%%%8.0f%10.6f%8.0f",
                    i,
                    "yes",
                    stats[i].util*100.0,
                    stats[i].ops,
                    stats[i].secs,
                    (stats[i].ops/1e3)/stats[i].secs);
+            printcounters(stats[i].counters, stats[i].ops);
             secs += stats[i].secs;
             ops += stats[i].ops;
             util += stats[i].util;
+            for (j = 0; j < NUM_PERFCTRS; j++)
+                if (counters[j] >= 0)
+                    counters[j] = (stats[i].counters[j] >= 0) ?
+                        counters[j] + stats[i].counters[j] : -1;
         } else {
-            printf("%2d%10s%6s%8s%10s%8s\n",
+            printf("%2d%10s%6s%8s%10s%8s",
                    i,
                    "no",
                    "-",
                    "-",
                    "-",
                    "-");
+            printcounters(NULL, 0);
         }
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-        printf("%12s%5.0f%%%8.0f%10.6f%8.0f\n",
+        printf("%12s%5.0f%%%8.0f%10.6f%8.0f",
                "Total       ",
                (util/n)*100.0,
                ops,
                secs,
                (ops/1e3)/secs);
+        printcounters(counters, ops);
     } else {
-        printf("%12s%6s%8s%10s%8s\n",
+        printf("%12s%6s%8s%10s%8s",
                "Total       ",
                "-",
                "-",
                "-",
                "-");
+        printcounters(NULL, 0);
+    }
+}
+
+/*
+ * printcounters - finish a line of results with its hardware events
+ *     per request, if they are being counted
+ */
+static void printcounters(double *counters, double ops) {
+    int j;
+
+    for (j = 0; counting && j < NUM_PERFCTRS; j++) {
+        if (counters == NULL || counters[j] < 0 || ops == 0)
+            printf("%8s", "-");
+        else
+            printf("%8.1f", counters[j] / ops);
+    }
+    printf("\n");
+}
+
+/*
+ * printlatency - prints latency percentiles for every request type a
+ *     trace makes
+ */
+static void printlatency(int n, stats_t *stats) {
+    int i, type;
+    lathist_t *hist;
+
+    printf("%5s%8s%9s%8s%8s%8s%8s%10s\n",
+           "trace", "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+        if (stats[i].latency == NULL)
+            continue;
+        for (type = 0; type < NUM_OP_TYPES; type++) {
+            hist = &stats[i].latency[type];
+            if (hist->count == 0)
+                continue;
+            printf("%2d%11s%9llu%8llu%8llu%8llu%8llu%10llu\n",
+                   i,
+                   op_names[type],
+                   (unsigned long long)hist->count,
+                   (unsigned long long)lathist_percentile(hist, 0.50),
+                   (unsigned long long)lathist_percentile(hist, 0.90),
+                   (unsigned long long)lathist_percentile(hist, 0.99),
+                   (unsigned long long)lathist_percentile(hist, 0.999),
+                   (unsigned long long)hist->max);
+        }
+    }
+}
+
+/*
+ * printtouch - prints the time and hardware events that touching the
+ *     payloads added to each trace, next to the allocator's own time
+ */
+static void printtouch(int n, stats_t *stats) {
+    int i, j;
+
+    printf("%5s%12s%12s%8s", "trace", "alloc secs", "app secs", "app%");
+    for (j = 0; counting && j < NUM_PERFCTRS; j++)
+        printf("%8s", perfctr_names[j]);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%2d%15.6f%12.6f%7.0f%%", i, stats[i].secs, stats[i].app_secs,
+               100 * stats[i].app_secs / (stats[i].secs + stats[i].app_secs));
+        printcounters(stats[i].app_counters, stats[i].ops);
+    }
+}
+
+/*
+ * printprofile - prints the calls and cycles of each phase of mm malloc.
+ *     A phase's cycles include those of the phases it calls, so a search
+ *     includes its split, and a split its add_free.
+ */
+static void printprofile(int n, stats_t *stats) {
+    PhaseProfile *p;
+    int i, phase;
+
+    printf("%5s%10s%12s%14s%10s%10s%8s\n", "trace", "phase", "calls",
+           "cycles", "cyc/call", "blks/call", "share");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].profiled)
+            continue;
+        for (phase = 0; phase < PROFILE_NUM_PHASES; phase++) {
+            p = &stats[i].profile[phase];
+            printf("%2d%13s%12llu%14llu%10.1f", i, phase_names[phase],
+                   (unsigned long long)p->calls, (unsigned long long)p->cycles,
+                   p->calls ? (double)p->cycles / p->calls : 0.0);
+            if (phase == PROFILE_SEARCH)
+                printf("%10.1f", p->calls ? (double)p->examined / p->calls : 0.0);
+            else
+                printf("%10s", "");
+            printf("%7.0f%%\n", 100 * p->cycles / stats[i].profile_cycles);
+        }
     }
 }
 
+/*
+ * printsites - prints the call sites that allocated the most bytes in
+ *     each trace. Counts and bytes are estimated from the samples; live
+ *     bytes are those not freed by the end of the trace.
+ */
+static void printsites(int n, stats_t *stats) {
+    HeapSite *site;
+    char **callers;
+    int i, j;
+
+    printf("%5s%9s%12s%14s%12s  %s\n", "trace", "samples", "allocs",
+           "bytes", "live bytes", "caller");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        for (j = 0; j < stats[i].num_sites && j < NUM_PRINTED_SITES; j++) {
+            site = &stats[i].sites[j];
+            callers = backtrace_symbols(site->stack, 1);
+            printf("%2d%12llu%12.0f%14.0f%12.0f  %s\n", i,
+                   (unsigned long long)site->samples, site->total_count,
+                   site->total_bytes, site->live_bytes > 0 ? site->live_bytes : 0,
+                   callers != NULL ? callers[0] : "?");
+            free(callers);
+        }
+    }
+}
+
+/*
+ * crash_handler - dump mm's flight recorder, then die of the signal
+ */
+static void crash_handler(int sig) {
+    mm_flight_dump(STDERR_FILENO);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -848,13 +2565,25 @@ void malloc_error(int tracenum, int opnum, char *msg) {
  * usage - Explain the command line arguments
  */
 static void usage(void) {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVclpPS] [-a <every>:<blocks>] [-H <bytes>] [-n <runs>]\n");
+    fprintf(stderr, "               [-o <file>] [-T <threads>] [-u <file> [-i <n>]] [-f <file>] [-t <dir>]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-a <e>:<b> Also time touching payloads, re-reading b every e requests.\n");
+    fprintf(stderr, "\t-c         Count hardware events per request for each trace.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <bytes> Sample mm's allocations every so many bytes, by call site.\n");
+    fprintf(stderr, "\t-i <n>     Sample the heap for -u every n requests (1000).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-n <runs>  Measure each trace this many times.\n");
+    fprintf(stderr, "\t-o <file>  Write every run's results as JSON, or CSV for a .csv file.\n");
+    fprintf(stderr, "\t-p         Print latency percentiles per request type.\n");
+    fprintf(stderr, "\t-P         With -T, give each thread the requests of a recorded thread.\n");
+    fprintf(stderr, "\t-S         Stream traces too large to load.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Replay each trace on 1, 2, 4... up to n threads at once.\n");
+    fprintf(stderr, "\t-u <file>  Write a CSV timeline of each trace's heap utilization.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -49,8 +49,8 @@ void mem_reset_brk() {
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. The
+ *    heap is shrunk with mem_trim.
  */
 void *mem_sbrk(size_t incr) {
   char *old_brk = mem_brk;
@@ -64,6 +64,19 @@ void *mem_sbrk(size_t incr) {
   return (void *)old_brk;
 }
 
+/*
+ * mem_trim - lowers the brk by decr bytes and returns the new brk.
+ */
+void *mem_trim(size_t decr) {
+  if (decr > (size_t)(mem_brk - mem_start_brk)) {
+    errno = EINVAL;
+    fprintf(stderr, "ERROR: mem_trim failed. Heap is smaller than the request...\n");
+    return (void *)-1;
+  }
+  mem_brk -= decr;
+  return (void *)mem_brk;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -3,6 +3,7 @@
 void mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(size_t incr);
+void *mem_trim(size_t decr);
 void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
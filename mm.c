@@ -1,11 +1,602 @@
+#include <execinfo.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "config.h"
 #include "memlib.h"
 #include "mm.h"
 
 #define DEBUG 0
 
+/** Set to 1, e.g. with make PROFILE=1, to count the calls and cycles of each phase. */
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+/** Set to 0, e.g. with make FLIGHT_RECORDER=0, to stop logging each thread's recent events. */
+#ifndef FLIGHT_RECORDER
+#define FLIGHT_RECORDER 1
+#endif
+
+/** Reads the time-stamp counter, or the monotonic clock in ns elsewhere. */
+static inline uint64_t read_cycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*********************************************/
+/************** Phase Profiling **************/
+/*********************************************/
+
+#if PROFILE
+/** Counts of every phase since the last mm_profile_reset. */
+static PhaseProfile profile[PROFILE_NUM_PHASES];
+
+#define PROFILE_ENTER(phase)                       \
+    uint64_t profile_start_##phase = read_cycles(); \
+    profile[phase].calls++
+#define PROFILE_LEAVE(phase) \
+    profile[phase].cycles += read_cycles() - profile_start_##phase
+#define PROFILE_EXAMINED(phase) profile[phase].examined++
+#else
+// compiled away entirely
+#define PROFILE_ENTER(phase)
+#define PROFILE_LEAVE(phase)
+#define PROFILE_EXAMINED(phase)
+#endif
+
+/*********************************************/
+/************** Flight Recorder **************/
+/*********************************************/
+
+#if FLIGHT_RECORDER
+/** Bits of a recorded address that hold the op; headers and heap breaks are word-aligned. */
+#define FLIGHT_OP_MASK ((uintptr_t)WORD_SIZE - 1)
+
+/**
+ * An event as the ring keeps it, in two words so that recording costs two
+ * stores. Its sequence number is its position in the ring, and it is not
+ * timed, since reading a clock would cost more than the rest of the event.
+ */
+typedef struct FlightSlot
+{
+    /** The address, with the op in its low bits. */
+    uintptr_t addr_op;
+    long size;
+} FlightSlot;
+
+/**
+ * The calling thread's last FLIGHT_EVENTS events. Each thread writes only
+ * its own ring, so recording takes no lock and no atomic.
+ */
+static __thread FlightSlot flight_ring[FLIGHT_EVENTS];
+/** Events the calling thread recorded so far; the next goes at this modulo FLIGHT_EVENTS. */
+static __thread uint64_t flight_count = 0;
+
+/** Unpacks event seq of the calling thread, which must still be in the ring. */
+static FlightEvent flight_event(uint64_t seq)
+{
+    FlightSlot *slot = &flight_ring[seq % FLIGHT_EVENTS];
+    FlightEvent event;
+
+    event.seq = seq;
+    event.addr = (void *)(slot->addr_op & ~FLIGHT_OP_MASK);
+    event.size = slot->size;
+    event.op = (FlightOp)(slot->addr_op & FLIGHT_OP_MASK);
+    return event;
+}
+
+/** Overwrites the oldest event of the calling thread's ring, without a call even at -O0. */
+#define FLIGHT_RECORD(op, addr, bytes)                                           \
+    do                                                                           \
+    {                                                                            \
+        FlightSlot *flight_slot = &flight_ring[flight_count++ % FLIGHT_EVENTS]; \
+        flight_slot->addr_op = (uintptr_t)(addr) | (op);                         \
+        flight_slot->size = (bytes);                                             \
+    } while (0)
+#else
+// compiled away entirely
+#define FLIGHT_RECORD(op, addr, bytes)
+#endif
+
+/*********************************************/
+/*********** Garbage Collector State *********/
+/*********************************************/
+
+/** Stage of the current collection cycle. */
+static GCPhase gc_phase = GC_IDLE;
+
+/** One bit per granule, set where a block header starts. */
+static uint64_t block_start_bits[GC_NUM_GRANULES / 64];
+/** One bit per granule, set where a marked block header starts. */
+static uint64_t mark_bits[GC_NUM_GRANULES / 64];
+
+/** Layout id of each allocated block, indexed by its header's granule. */
+static uint8_t block_layouts[GC_NUM_GRANULES];
+
+/** Registered layouts; the conservative layout occupies id 0. */
+static Layout layouts[GC_MAX_LAYOUTS];
+static int num_layouts = 1;
+
+/** Grey blocks that have been marked but not yet scanned. */
+static Block **mark_stack = NULL;
+static size_t mark_stack_top = 0;
+static size_t mark_stack_capacity = 0;
+
+/** Roots of the current cycle, rescanned when the mark stack runs dry. */
+static void **gc_roots = NULL;
+static size_t gc_num_roots = 0;
+
+/** Next block the lazy sweep will visit, or NULL once it reached the end. */
+static Block *sweep_cursor = NULL;
+
+/** Addresses of root variables the program registered, scanned precisely. */
+static void ***registered_roots = NULL;
+static size_t num_registered_roots = 0;
+static size_t registered_roots_capacity = 0;
+
+/** Base of the stack scanned for roots, or NULL when scanning is off. */
+static void *stack_base = NULL;
+
+/** Set while mm_gc_compact marks, so conservative references pin. */
+static int gc_compacting = 0;
+/** One bit per granule, set where a block that must not move starts. */
+static uint64_t pin_bits[GC_NUM_GRANULES / 64];
+
+/** Old-generation block whose payload holds the nursery, or NULL. */
+static Block *nursery_block = NULL;
+/** First object, bump pointer and end of the nursery. */
+static char *nursery_lo = NULL;
+static char *nursery_top = NULL;
+static char *nursery_hi = NULL;
+/** One bit per granule, set where a young object's header starts. */
+static uint64_t nursery_start_bits[GC_NUM_GRANULES / 64];
+
+/** One byte per card, set when the card may hold an old-to-young pointer. */
+static uint8_t cards[MAX_HEAP / GC_CARD_SIZE];
+/** Indices of the dirty cards, so a minor collection skips clean ones. */
+static size_t *dirty_cards = NULL;
+static size_t num_dirty_cards = 0;
+static size_t dirty_cards_capacity = 0;
+
+/** Tunables of the automatic trigger, kept across mm_init. */
+static int gc_percent = GC_PERCENT_OFF;
+static size_t gc_soft_limit = 0;
+
+/** Threads a sweep to the end of the heap may use, kept across mm_init. */
+static int sweep_threads = 1;
+/** Sweeps that were split among threads, counted across mm_init. */
+static size_t parallel_sweeps = 0;
+
+/** Bytes handed out by mm_malloc since the last cycle started. */
+static size_t allocated_since_gc = 0;
+/** Nanoseconds allocations spent collecting on the program's behalf since mm_init. */
+static uint64_t gc_assist_ns = 0;
+/** Bytes of blocks marked by the current cycle. */
+static size_t marked_bytes = 0;
+/** Bytes that survived the last finished cycle. */
+static size_t live_bytes = 0;
+
+/** Set during a minor collection, whose promotions must not trigger a cycle. */
+static int gc_in_minor = 0;
+
+/** Promoted blocks whose pointer slots still need forwarding. */
+static Block **promoted = NULL;
+static size_t num_promoted = 0;
+static size_t promoted_capacity = 0;
+
+static inline size_t granule_of(void *addr)
+{
+    return ((char *)addr - (char *)mem_heap_lo()) / GC_GRANULE_SIZE;
+}
+
+static inline void set_bit(uint64_t *bits, size_t i)
+{
+    bits[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static inline void clear_bit(uint64_t *bits, size_t i)
+{
+    bits[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+static inline int test_bit(uint64_t *bits, size_t i)
+{
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+/**
+ * Returns the closest header at or below granule i whose bit is set,
+ * looking no lower than granule lo, or NULL if there is none.
+ */
+static Block *find_header(uint64_t *bits, size_t i, size_t lo)
+{
+    size_t word = i / 64;
+    uint64_t mask = bits[word] & (~(uint64_t)0 >> (63 - i % 64));
+    while (mask == 0)
+    {
+        if (word == lo / 64)
+        {
+            return NULL;
+        }
+        mask = bits[--word];
+    }
+
+    size_t start = word * 64 + 63 - __builtin_clzll(mask);
+    if (start < lo)
+    {
+        return NULL;
+    }
+
+    return (Block *)UNSCALED_POINTER_ADD(mem_heap_lo(), start * GC_GRANULE_SIZE);
+}
+
+/**
+ * Returns the closest header at or above granule i whose bit is set,
+ * looking no higher than below granule hi, or NULL if there is none.
+ */
+static Block *find_next_header(uint64_t *bits, size_t i, size_t hi)
+{
+    size_t word = i / 64;
+    uint64_t mask = bits[word] & (~(uint64_t)0 << (i % 64));
+    while (mask == 0)
+    {
+        if (++word * 64 >= hi)
+        {
+            return NULL;
+        }
+        mask = bits[word];
+    }
+
+    size_t start = word * 64 + __builtin_ctzll(mask);
+    if (start >= hi)
+    {
+        return NULL;
+    }
+
+    return (Block *)UNSCALED_POINTER_ADD(mem_heap_lo(), start * GC_GRANULE_SIZE);
+}
+
+/** Forgets the header of a block that coalesce merged into survivor. */
+static inline void absorb_block(Block *absorbed, Block *survivor)
+{
+    clear_bit(block_start_bits, granule_of(absorbed));
+
+    // keep the lazy sweep on a live header
+    if (sweep_cursor == absorbed)
+    {
+        sweep_cursor = survivor;
+    }
+}
+
+/** Returns whether ptr points into the nursery. */
+static inline int in_nursery(void *ptr)
+{
+    return (char *)ptr >= nursery_lo && (char *)ptr < nursery_hi;
+}
+
+/** Cleans every dirty card. */
+static void clear_cards()
+{
+    for (size_t i = 0; i < num_dirty_cards; i++)
+    {
+        cards[dirty_cards[i]] = 0;
+    }
+    num_dirty_cards = 0;
+}
+
+/**
+ * Doubles the capacity of an array kept outside of the managed heap once
+ * count reaches it. Returns the possibly moved array.
+ */
+static void *grow_array(void *array, size_t count, size_t *capacity, size_t element_size)
+{
+    if (count < *capacity)
+    {
+        return array;
+    }
+
+    *capacity = (*capacity == 0) ? 256 : 2 * *capacity;
+    array = realloc(array, *capacity * element_size);
+    if (array == NULL)
+    {
+        printf("ERROR: realloc failed in grow_array\n");
+        exit(0);
+    }
+
+    return array;
+}
+
+/** Bytes to allocate after the last cycle before the trigger fires. */
+static inline size_t gc_trigger_bytes()
+{
+    size_t trigger = live_bytes / 100 * gc_percent;
+    return (trigger > GC_MIN_TRIGGER) ? trigger : GC_MIN_TRIGGER;
+}
+
+/** Number of bytes of a granule bitmap that cover the current heap. */
+static inline size_t bitmap_bytes()
+{
+    return ((heap_size / GC_GRANULE_SIZE + 63) / 64) * sizeof(uint64_t);
+}
+
+/** Reads the monotonic clock in ns, to time the collecting allocations do. */
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Counts bytes handed out, starting a cycle once the heap grew by the configured share of live data. */
+static void count_allocation(size_t bytes)
+{
+    allocated_since_gc += bytes;
+    if (gc_phase == GC_IDLE && !gc_in_minor && gc_percent != GC_PERCENT_OFF &&
+        allocated_since_gc >= gc_trigger_bytes())
+    {
+        uint64_t start = now_ns();
+        mm_gc_start(NULL, 0);
+        gc_assist_ns += now_ns() - start;
+    }
+}
+
+/**
+ * Finishes a collection, starting one if needed, when growing the heap by
+ * bytes would pass the soft limit. Returns whether it collected.
+ */
+static int collect_before_growing(size_t bytes)
+{
+    if (gc_soft_limit == 0 || gc_in_minor || heap_size + bytes <= gc_soft_limit ||
+        allocated_since_gc < GC_MIN_TRIGGER)
+    {
+        return 0;
+    }
+
+    uint64_t start = now_ns();
+    if (gc_phase == GC_IDLE)
+    {
+        mm_gc_start(NULL, 0);
+    }
+    while (!mm_gc_step(SIZE_MAX))
+    {
+    }
+    gc_assist_ns += now_ns() - start;
+    return 1;
+}
+
+/*********************************************/
+/*************** Heap Sampling ***************/
+/*********************************************/
+
+/** A sampled block that has not been freed yet. */
+typedef struct SampledBlock
+{
+    /** Its payload, or NULL for an empty slot. */
+    void *ptr;
+    /** Index of the site that allocated it. */
+    int site;
+    /** Allocations and bytes it stands for. */
+    double count;
+    double bytes;
+} SampledBlock;
+
+/** Mean bytes between samples, or 0 when not sampling. */
+static size_t sample_interval = 0;
+/** Bytes left to allocate before the next sample; never reached when off. */
+static long sample_countdown = LONG_MAX;
+/** State of the xorshift generator the intervals are drawn from. */
+static uint64_t sample_seed = 88172645463325252ULL;
+
+/** Sites of the current profile, an open-addressed table keyed by call stack. */
+static HeapSite sample_sites[HEAP_SAMPLE_SITES];
+/** Live sampled blocks, an open-addressed table keyed by payload. */
+static SampledBlock sampled_blocks[HEAP_SAMPLE_LIVE];
+static int num_sampled_blocks = 0;
+
+/** Draws the bytes until the next sample, exponentially distributed. */
+static long next_sample_countdown()
+{
+    if (sample_interval == 0)
+    {
+        return LONG_MAX;
+    }
+
+    sample_seed ^= sample_seed << 13;
+    sample_seed ^= sample_seed >> 7;
+    sample_seed ^= sample_seed << 17;
+
+    // uniform in (0, 1], so the log is finite
+    double uniform = ((sample_seed >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (long)(-log(uniform) * sample_interval) + 1;
+}
+
+/** Returns the slot of ptr in sampled_blocks, or of the empty slot it would take. */
+static int sampled_slot(void *ptr)
+{
+    size_t i = ((uintptr_t)ptr / FREE_INFO_SIZE) * 0x9E3779B97F4A7C15ULL % HEAP_SAMPLE_LIVE;
+    while (sampled_blocks[i].ptr != NULL && sampled_blocks[i].ptr != ptr)
+    {
+        i = (i + 1) % HEAP_SAMPLE_LIVE;
+    }
+    return i;
+}
+
+/** Empties a slot of sampled_blocks, shifting back the entries probed past it. */
+static void remove_sampled_slot(int slot)
+{
+    size_t hole = slot;
+    size_t i = (hole + 1) % HEAP_SAMPLE_LIVE;
+    while (sampled_blocks[i].ptr != NULL)
+    {
+        size_t home = ((uintptr_t)sampled_blocks[i].ptr / FREE_INFO_SIZE) * 0x9E3779B97F4A7C15ULL % HEAP_SAMPLE_LIVE;
+
+        // an entry may fill the hole if the hole lies between its home and it
+        if ((i - home + HEAP_SAMPLE_LIVE) % HEAP_SAMPLE_LIVE >= (i - hole + HEAP_SAMPLE_LIVE) % HEAP_SAMPLE_LIVE)
+        {
+            sampled_blocks[hole] = sampled_blocks[i];
+            hole = i;
+        }
+        i = (i + 1) % HEAP_SAMPLE_LIVE;
+    }
+    sampled_blocks[hole].ptr = NULL;
+    num_sampled_blocks--;
+}
+
+/** Returns the index of the site for a call stack, claiming one if it is new, or -1 when full. */
+static int find_site(void **stack, int depth)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < depth; i++)
+    {
+        hash = (hash ^ (uintptr_t)stack[i]) * 1099511628211ULL;
+    }
+
+    size_t i = hash % HEAP_SAMPLE_SITES;
+    for (int probes = 0; probes < HEAP_SAMPLE_SITES; probes++)
+    {
+        HeapSite *site = &sample_sites[i];
+        if (site->depth == 0)
+        {
+            memcpy(site->stack, stack, depth * sizeof(void *));
+            site->depth = depth;
+            return i;
+        }
+        if (site->depth == depth && memcmp(site->stack, stack, depth * sizeof(void *)) == 0)
+        {
+            return i;
+        }
+        i = (i + 1) % HEAP_SAMPLE_SITES;
+    }
+    return -1;
+}
+
+/**
+ * Records an allocation of size bytes at ptr, which the countdown chose,
+ * and draws the next countdown. Kept out of line so mm_malloc only pays
+ * for the decrement.
+ */
+static void __attribute__((noinline)) sample_allocation(void *ptr, size_t size)
+{
+    sample_countdown = next_sample_countdown();
+    if (sample_interval == 0 || num_sampled_blocks >= HEAP_SAMPLE_LIVE / 2)
+    {
+        return;
+    }
+
+    // drop this function's and mm_malloc's frames
+    void *stack[HEAP_SAMPLE_DEPTH + 2];
+    int depth = backtrace(stack, HEAP_SAMPLE_DEPTH + 2) - 2;
+    if (depth <= 0)
+    {
+        return;
+    }
+
+    int index = find_site(stack + 2, depth);
+    if (index < 0)
+    {
+        return;
+    }
+
+    // a block of size bytes is sampled with probability 1 - e^(-size / interval)
+    double count = 1 / -expm1(-(double)size / sample_interval);
+    HeapSite *site = &sample_sites[index];
+    site->samples++;
+    site->total_count += count;
+    site->total_bytes += count * size;
+    site->live_count += count;
+    site->live_bytes += count * size;
+
+    int slot = sampled_slot(ptr);
+    sampled_blocks[slot].ptr = ptr;
+    sampled_blocks[slot].site = index;
+    sampled_blocks[slot].count = count;
+    sampled_blocks[slot].bytes = count * size;
+    num_sampled_blocks++;
+}
+
+/** Takes a freed block out of its site's live statistics, if it was sampled. */
+static void sample_free(void *ptr)
+{
+    int slot = sampled_slot(ptr);
+    if (sampled_blocks[slot].ptr == NULL)
+    {
+        return;
+    }
+
+    HeapSite *site = &sample_sites[sampled_blocks[slot].site];
+    site->live_count -= sampled_blocks[slot].count;
+    site->live_bytes -= sampled_blocks[slot].bytes;
+    remove_sampled_slot(slot);
+}
+
+/** Follows a sampled block that moved from ptr to newptr. */
+static void sample_move(void *ptr, void *newptr)
+{
+    int slot = sampled_slot(ptr);
+    if (sampled_blocks[slot].ptr == NULL)
+    {
+        return;
+    }
+
+    SampledBlock moved = sampled_blocks[slot];
+    remove_sampled_slot(slot);
+
+    // a sampled block that died at newptr without being freed is gone now
+    sample_free(newptr);
+
+    moved.ptr = newptr;
+    sampled_blocks[sampled_slot(newptr)] = moved;
+    num_sampled_blocks++;
+}
+
+/** Forgets the live sampled blocks, when the heap they were in goes away. */
+static void forget_sampled_blocks()
+{
+    for (int i = 0; i < HEAP_SAMPLE_SITES; i++)
+    {
+        sample_sites[i].live_count = 0;
+        sample_sites[i].live_bytes = 0;
+    }
+    memset(sampled_blocks, 0, sizeof(sampled_blocks));
+    num_sampled_blocks = 0;
+}
+
+void mm_sample_heap(size_t interval)
+{
+    memset(sample_sites, 0, sizeof(sample_sites));
+    forget_sampled_blocks();
+    sample_interval = interval;
+    sample_countdown = next_sample_countdown();
+}
+
+int mm_heap_sites(HeapSite *sites, int max)
+{
+    int count = 0;
+    for (int i = 0; i < HEAP_SAMPLE_SITES && count < max; i++)
+    {
+        if (sample_sites[i].depth > 0)
+        {
+            sites[count++] = sample_sites[i];
+        }
+    }
+    return count;
+}
+
 /*********************************************/
 /************* Manage Heap Memory ************/
 /*********************************************/
@@ -22,14 +613,46 @@ void *mm_malloc(size_t size)
     // determine size of data and size of request
     long int reqSize = FREE_INFO_SIZE * ((size + FREE_INFO_SIZE - 1) / FREE_INFO_SIZE); // adjust for header and alignment
 
+    // start a cycle once the heap grew by the configured share of live data
+    count_allocation(reqSize);
+
     Block *block = searchFreeList(reqSize);
 
+    // pay for a miss with a slice of marking proportional to the request;
+    // a minor collection promoting blocks must not end marking or sweep
+    // the old blocks whose slots it is forwarding
+    if (block == NULL && gc_phase == GC_MARKING && !gc_in_minor)
+    {
+        uint64_t start = now_ns();
+        mm_gc_step(GC_WORK_RATIO * reqSize / WORD_SIZE);
+        gc_assist_ns += now_ns() - start;
+    }
+
+    // sweep only as much of the heap as it takes to free a fit
+    if (block == NULL && gc_phase == GC_SWEEPING && !gc_in_minor)
+    {
+        uint64_t start = now_ns();
+        block = gc_sweep(reqSize, SIZE_MAX);
+        gc_assist_ns += now_ns() - start;
+        if (block != NULL && (labs(block->info.size) - reqSize >= SPLIT_THRESHOLD))
+        {
+            split(block, reqSize);
+        }
+    }
+
+    // collect before growing the heap past the soft limit
+    if (block == NULL && collect_before_growing(INFO_SIZE + reqSize))
+    {
+        block = searchFreeList(reqSize);
+    }
+
     // check for no fit
     if (block == NULL)
     {
         // request enough for the header
         block = (Block *)requestMoreSpace(INFO_SIZE + reqSize);
         block->info.size = -reqSize;
+        set_bit(block_start_bits, granule_of(block));
 
         insert_at_tail(block);
     }
@@ -41,17 +664,43 @@ void *mm_malloc(size_t size)
     // allocate block
     block->info.size *= -1;
 
+    // untyped blocks are scanned conservatively
+    block_layouts[granule_of(block)] = GC_LAYOUT_CONSERVATIVE;
+
+    // blocks allocated during a cycle are black so they survive it
+    if (gc_phase != GC_IDLE)
+    {
+        set_bit(mark_bits, granule_of(block));
+        marked_bytes += INFO_SIZE + reqSize;
+    }
+
 #if DEBUG
     // DEBUG
     check_heap();
 #endif
 
+    FLIGHT_RECORD(FLIGHT_ALLOC, block, reqSize);
+
+    // sample about one allocation in every sample_interval bytes
+    sample_countdown -= reqSize;
+    if (sample_countdown < 0)
+    {
+        sample_allocation(UNSCALED_POINTER_ADD(block, INFO_SIZE), size);
+    }
+
     return UNSCALED_POINTER_ADD(block, INFO_SIZE); // pointer to the data
 }
 
 void mm_free(void *ptr)
 {
+    // young objects are reclaimed by minor collections
+    if (in_nursery(ptr))
+    {
+        return;
+    }
+
     Block *block = (Block *)UNSCALED_POINTER_SUB(ptr, INFO_SIZE); // pointer to a block
+    FLIGHT_RECORD(FLIGHT_FREE, block, block->info.size);
 
     if (block->info.size <= 0)
     {
@@ -60,6 +709,11 @@ void mm_free(void *ptr)
     }
     block->info.size *= -1;
 
+    if (num_sampled_blocks > 0)
+    {
+        sample_free(ptr);
+    }
+
     // update the free list
     add_to_free_list(block);
     coalesce(block);
@@ -70,51 +724,233 @@ void mm_free(void *ptr)
 #endif
 }
 
-/*********************************************/
-/**************** Searching  *****************/
-/*********************************************/
-
-Block *searchList(size_t reqSize)
+/** Returns the tail of an allocated block past reqSize to the free list. */
+static void trim_block(Block *block, size_t reqSize)
 {
-    // check for positive request size
-    if (reqSize <= 0)
+    if (block->info.size - reqSize < SPLIT_THRESHOLD)
     {
-        fprintf(stderr, "searchList(): The request size must be more than 0.");
-        return NULL;
+        return;
     }
 
-    Block *curr = first_block();
+    split(block, reqSize);
+    block->info.size = reqSize;
+    coalesce(next_block(block));
+}
 
-    // check for empty list
-    if (curr == NULL)
+void *mm_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
     {
-        return NULL;
+        return mm_malloc(size);
     }
-
-    while ((curr != NULL) &&
-           (curr->info.size > 0 ||
-            -(curr->info.size) < (signed long long)(reqSize)))
+    if (size == 0)
     {
-        curr = next_block(curr);
+        mm_free(ptr);
+        return NULL;
     }
 
-    return curr;
-}
+    Block *block = (Block *)UNSCALED_POINTER_SUB(ptr, INFO_SIZE);
+    long int reqSize = FREE_INFO_SIZE * ((size + FREE_INFO_SIZE - 1) / FREE_INFO_SIZE);
+    long int oldSize = labs(block->info.size);
 
-Block *searchFreeList(size_t reqSize)
-{
-    // check for positive request size
-    if (reqSize <= 0)
+    if (!in_nursery(ptr))
     {
-        fprintf(stderr, "searchList(): The request size must be more than 0.");
-        return NULL;
-    }
+        // shrink in place
+        if (block->info.size >= reqSize)
+        {
+            trim_block(block, reqSize);
+            return ptr;
+        }
 
-    Block *curr = free_list_head;
+        // grow into a free successor, the way coalesce merges it; a free
+        // tail is taken even when short, as the heap can grow behind it
+        Block *next = next_block(block);
+        if (next != NULL && next->info.size < 0 &&
+            (block->info.size + INFO_SIZE + labs(next->info.size) >= reqSize ||
+             next == malloc_list_tail))
+        {
+            remove_from_free_list(next);
+            block->info.size += INFO_SIZE + labs(next->info.size);
 
-    // check for empty list
+            Block *new_next = next_block(block);
+            if (new_next != NULL)
+            {
+                new_next->info.prev = block;
+            }
+            else // next was the list tail
+            {
+                malloc_list_tail = block;
+            }
+            absorb_block(next, block);
+
+            if (block->info.size >= reqSize)
+            {
+                trim_block(block, reqSize);
+                return ptr;
+            }
+        }
+
+        // the last block grows by extending the heap, unless that passes
+        // the soft limit and the collection it runs may free a fit
+        if (block == malloc_list_tail)
+        {
+            long int growth = reqSize - block->info.size;
+            count_allocation(growth);
+            if (!collect_before_growing(growth))
+            {
+                requestMoreSpace(growth);
+                block->info.size = reqSize;
+                return ptr;
+            }
+        }
+    }
+
+    // move the payload, keeping its layout
+    void *newptr = mm_malloc(size);
+    if (newptr == NULL)
+    {
+        return NULL;
+    }
+    memcpy(newptr, ptr, (oldSize < (long int)size) ? oldSize : size);
+    Block *new_block = (Block *)UNSCALED_POINTER_SUB(newptr, INFO_SIZE);
+    block_layouts[granule_of(new_block)] = block_layouts[granule_of(block)];
+
+    // mm_malloc made the copy black during marking, so the pointers it
+    // took over must be shaded or their targets would be swept
+    if (gc_phase == GC_MARKING)
+    {
+        gc_scan_block(new_block);
+    }
+    mm_free(ptr);
+
+    return newptr;
+}
+
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    // the product must not overflow
+    if (size != 0 && nmemb > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+
+    void *ptr = mm_malloc(nmemb * size);
+    if (ptr != NULL)
+    {
+        memset(ptr, 0, nmemb * size);
+    }
+
+    return ptr;
+}
+
+void *mm_memalign(size_t alignment, size_t size)
+{
+    // alignments must be powers of two
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        fprintf(stderr, "mm_memalign(): The alignment must be a power of two.");
+        return NULL;
+    }
+
+    // every payload is already aligned this much
+    if (alignment <= FREE_INFO_SIZE)
+    {
+        return mm_malloc(size);
+    }
+
+    // leave room for a free block in front of the aligned payload
+    char *ptr = mm_malloc(size + alignment + SPLIT_THRESHOLD);
+    if (ptr == NULL)
+    {
+        return NULL;
+    }
+    Block *block = (Block *)UNSCALED_POINTER_SUB(ptr, INFO_SIZE);
+    char *aligned = (char *)(((uintptr_t)ptr + SPLIT_THRESHOLD + alignment - 1) & ~(uintptr_t)(alignment - 1));
+
+    // the aligned payload gets a header of its own...
+    Block *new = (Block *)UNSCALED_POINTER_SUB(aligned, INFO_SIZE);
+    new->info.size = block->info.size - ((char *)new - (char *)block);
+    new->info.prev = block;
+    set_bit(block_start_bits, granule_of(new));
+    block_layouts[granule_of(new)] = GC_LAYOUT_CONSERVATIVE;
+    if (gc_phase != GC_IDLE)
+    {
+        set_bit(mark_bits, granule_of(new));
+    }
+
+    Block *next = next_block(new);
+    if (next != NULL)
+    {
+        next->info.prev = new;
+    }
+    else
+    {
+        malloc_list_tail = new;
+    }
+
+    // ...and the space in front of it is freed
+    block->info.size = -((char *)new - (char *)block - (long int)INFO_SIZE);
+    add_to_free_list(block);
+    coalesce(block);
+
+    long int reqSize = FREE_INFO_SIZE * ((size + FREE_INFO_SIZE - 1) / FREE_INFO_SIZE);
+    trim_block(new, reqSize);
+
+    if (num_sampled_blocks > 0)
+    {
+        sample_move(ptr, aligned);
+    }
+
+    return aligned;
+}
+
+/*********************************************/
+/**************** Searching  *****************/
+/*********************************************/
+
+Block *searchList(size_t reqSize)
+{
+    // check for positive request size
+    if (reqSize <= 0)
+    {
+        fprintf(stderr, "searchList(): The request size must be more than 0.");
+        return NULL;
+    }
+
+    Block *curr = first_block();
+
+    // check for empty list
+    if (curr == NULL)
+    {
+        return NULL;
+    }
+
+    while ((curr != NULL) &&
+           (curr->info.size > 0 ||
+            -(curr->info.size) < (signed long long)(reqSize)))
+    {
+        curr = next_block(curr);
+    }
+
+    return curr;
+}
+
+Block *searchFreeList(size_t reqSize)
+{
+    // check for positive request size
+    if (reqSize <= 0)
+    {
+        fprintf(stderr, "searchList(): The request size must be more than 0.");
+        return NULL;
+    }
+
+    PROFILE_ENTER(PROFILE_SEARCH);
+    Block *curr = free_list_head;
+
+    // check for empty list
     if (curr == NULL)
     {
+        PROFILE_LEAVE(PROFILE_SEARCH);
         return NULL;
     }
 
@@ -123,15 +959,21 @@ Block *searchFreeList(size_t reqSize)
            (curr->info.size > 0 ||
             -(curr->info.size) < (signed long long)(reqSize)))
     {
+        PROFILE_EXAMINED(PROFILE_SEARCH);
         curr = next_block(curr);
     }
 
     // split block if possible
-    if (curr != NULL && (labs(curr->info.size) - reqSize >= SPLIT_THRESHOLD))
+    if (curr != NULL)
     {
-        split(curr, reqSize);
+        PROFILE_EXAMINED(PROFILE_SEARCH);
+        if (labs(curr->info.size) - reqSize >= SPLIT_THRESHOLD)
+        {
+            split(curr, reqSize);
+        }
     }
 
+    PROFILE_LEAVE(PROFILE_SEARCH);
     return curr;
 }
 
@@ -141,11 +983,15 @@ Block *searchFreeList(size_t reqSize)
 
 void coalesce(Block *block)
 {
+    PROFILE_ENTER(PROFILE_COALESCE);
     Block *prev = block->info.prev;
     Block *next = next_block(block);
 
+    // only a merge takes a slot of the flight recorder's ring
     if (prev != NULL && prev->info.size < 0)
     {
+        FLIGHT_RECORD(FLIGHT_COALESCE, block, labs(block->info.size));
+
         // coalesce all three blocks
         if (next != NULL && next->info.size < 0)
         {
@@ -166,6 +1012,8 @@ void coalesce(Block *block)
             // remove blocks from free list
             remove_from_free_list(block);
             remove_from_free_list(next);
+            absorb_block(block, prev);
+            absorb_block(next, prev);
 
 #if DEBUG
             // DEBUG
@@ -180,6 +1028,7 @@ void coalesce(Block *block)
 
             // update malloc and free lists
             remove_from_free_list(block);
+            absorb_block(block, prev);
             if (next != NULL) // update previous pointer
             {
                 next->info.prev = prev;
@@ -198,6 +1047,8 @@ void coalesce(Block *block)
     // coalesce current and next blocks
     else if (next != NULL && next->info.size < 0)
     {
+        FLIGHT_RECORD(FLIGHT_COALESCE, block, labs(block->info.size));
+
         // update current's size
         block->info.size -= INFO_SIZE + labs(next->info.size);
 
@@ -214,290 +1065,1639 @@ void coalesce(Block *block)
 
         // remove block from free list
         remove_from_free_list(next);
+        absorb_block(next, block);
 
 #if DEBUG
         // DEBUG
         check_heap();
 #endif
     }
+
+    PROFILE_LEAVE(PROFILE_COALESCE);
+}
+
+void split(Block *block, size_t reqSize)
+{
+    PROFILE_ENTER(PROFILE_SPLIT);
+    FLIGHT_RECORD(FLIGHT_SPLIT, block, reqSize);
+
+    // create a new block
+    Block *new = (Block *)UNSCALED_POINTER_ADD(block, INFO_SIZE + reqSize);
+    new->info.prev = block;
+    new->info.size = -(labs(block->info.size) - (INFO_SIZE + reqSize)); // already aligned
+    set_bit(block_start_bits, granule_of(new));
+
+    // add to lists
+    add_to_free_list(new);
+    Block *next = next_block(block);
+    if (next != NULL)
+    {
+        next->info.prev = new;
+    }
+    else
+    {
+        malloc_list_tail = new;
+    }
+
+    // update previous block's size
+    block->info.size = -reqSize;
+
+#if DEBUG
+    // DEBUG
+    check_heap();
+#endif
+
+    PROFILE_LEAVE(PROFILE_SPLIT);
+}
+
+/*********************************************/
+/*********** Linked List Functions ***********/
+/*********************************************/
+
+void insert_at_tail(Block *block)
+{
+    block->info.prev = malloc_list_tail;
+    malloc_list_tail = block;
+
+#if DEBUG
+    // DEBUG
+    check_heap();
+#endif
+}
+
+void add_to_free_list(Block *block)
+{
+    PROFILE_ENTER(PROFILE_ADD_FREE);
+
+    // empty list
+    if (free_list_head == NULL)
+    {
+        block->freeNode.nextFree = NULL;
+        block->freeNode.prevFree = NULL;
+        free_list_head = block;
+    }
+
+    // append to the beginning of the list
+    else
+    {
+        free_list_head->freeNode.prevFree = block;
+        block->freeNode.nextFree = free_list_head;
+        block->freeNode.prevFree = NULL;
+        free_list_head = block;
+    }
+
+#if DEBUG
+    // DEBUG
+    check_heap();
+#endif
+
+    PROFILE_LEAVE(PROFILE_ADD_FREE);
+}
+
+void remove_from_free_list(Block *block)
+{
+    Block *prev = block->freeNode.prevFree;
+    Block *next = block->freeNode.nextFree;
+
+    // set the previous' next to the previous
+    if (prev != NULL)
+    {
+        prev->freeNode.nextFree = next;
+    }
+    else // update head of the list
+    {
+        free_list_head = next;
+    }
+
+    // set the next's previous to the previous
+    if (next != NULL)
+    {
+        next->freeNode.prevFree = prev;
+    }
+
+#if DEBUG
+    // DEBUG
+    check_heap();
+#endif
+}
+
+/*********************************************/
+/*************** Inspect Heap  ***************/
+/*********************************************/
+
+void examine_heap()
+{
+    // print to stderr so output isn't buffered and not output if we crash
+    Block *curr = (Block *)mem_heap_lo();                                 // pointer to the current block
+    Block *end = (Block *)UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size); // pointer to the tail block
+    void *prev = NULL;
+
+    fprintf(stderr, "heap size:\t0x%lu\n", (long)heap_size);
+    fprintf(stderr, "heap start:\t%p\n", curr);
+    fprintf(stderr, "heap end:\t%p\n", end);
+
+    fprintf(stderr, "free_list_head: %p\n", (void *)free_list_head);
+
+    fprintf(stderr, "malloc_list_tail: %p\n", (void *)malloc_list_tail);
+
+    int all_correct = 1;
+    while (curr && curr < end)
+    {
+        // print out common block attributes
+        fprintf(stderr, "%p: %ld\t", (void *)curr, curr->info.size);
+
+        // and allocated/free specific data
+        if (curr->info.size > 0)
+        {
+            fprintf(stderr, "ALLOCATED\tprev: %p", (void *)curr->info.prev);
+        }
+        else
+        {
+            fprintf(stderr, "FREE\tnextFree: %p, prevFree: %p, prev: %p", (void *)curr->freeNode.nextFree, (void *)curr->freeNode.prevFree, (void *)curr->info.prev);
+        }
+
+        // verify previous pointers
+        if (curr->info.prev == prev)
+        {
+            fprintf(stderr, " ✓\n");
+        }
+        else
+        {
+            fprintf(stderr, " ✗\n");
+            all_correct = 0;
+        }
+
+        // move to next
+        prev = curr;
+        curr = next_block(curr);
+    }
+    fprintf(stderr, "END OF HEAP\n\n");
+
+    if (!all_correct)
+    {
+        fprintf(stderr, "Not all pointers were correct.");
+    }
+
+    examine_free_list();
+
+    fprintf(stderr, "\n");
+}
+
+void examine_free_list()
+{
+    Block *curr = free_list_head;
+    fprintf(stderr, "HEAD OF FREE LIST: ");
+
+    // print out links
+    while (curr)
+    {
+        fprintf(stderr, "-> %p ", curr);
+        curr = curr->freeNode.nextFree;
+    }
+}
+
+void mm_heap_stats(HeapStats *stats)
+{
+    stats->free_bytes = 0;
+    stats->largest_free = 0;
+    stats->free_blocks = 0;
+
+    for (Block *curr = free_list_head; curr != NULL; curr = curr->freeNode.nextFree)
+    {
+        size_t size = labs(curr->info.size);
+
+        stats->free_bytes += size;
+        stats->free_blocks++;
+        if (size > stats->largest_free)
+        {
+            stats->largest_free = size;
+        }
+    }
+}
+
+int mm_profile(PhaseProfile out[PROFILE_NUM_PHASES])
+{
+#if PROFILE
+    memcpy(out, profile, sizeof(profile));
+    return 1;
+#else
+    memset(out, 0, PROFILE_NUM_PHASES * sizeof(PhaseProfile));
+    return 0;
+#endif
+}
+
+void mm_profile_reset()
+{
+#if PROFILE
+    memset(profile, 0, sizeof(profile));
+#endif
+}
+
+int check_heap()
+{
+    Block *curr = (Block *)mem_heap_lo();
+    Block *end = (Block *)UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size);
+    Block *last = NULL;
+    long int free_count = 0;
+    int errors = 0;
+
+    while (curr && curr < end)
+    {
+        if (curr->info.prev != last)
+        {
+            errors++;
+            examine_heap();
+            fprintf(stderr, "check_heap: Error: previous link not correct.\nCurr = %p, curr->prev = %p, previous = %p\n\n",
+                    curr, curr->info.prev, last);
+        }
+
+        if (curr->info.size <= 0)
+        {
+            // Free
+            free_count++;
+        }
+
+        last = curr;
+        curr = next_block(curr);
+    }
+
+    // check malloc list tail
+    if (last != malloc_list_tail)
+    {
+        errors++;
+        fprintf(stderr, "check_heap: Error: malloc list tail incorrect\nCurrent Tail: %p, Correct Tail: %p",
+                malloc_list_tail, last);
+    }
+
+    curr = free_list_head;
+    last = NULL;
+    while (curr)
+    {
+        if (curr == last)
+        {
+            errors++;
+            examine_heap();
+            fprintf(stderr, "check_heap: Error: free list is circular.\n\n");
+        }
+        last = curr;
+        curr = curr->freeNode.nextFree;
+        if (free_count == 0)
+        {
+            errors++;
+            examine_heap();
+            fprintf(stderr, "check_heap: Error: free list has more items than expected.\n\n");
+        }
+        free_count--;
+    }
+
+    // show what led up to the corruption
+    if (errors > 0)
+    {
+        fflush(stderr);
+        mm_flight_dump(STDERR_FILENO);
+    }
+
+    return 0;
+}
+
+#if FLIGHT_RECORDER
+/** Appends s to the buffer at *end, up to limit. */
+static void flight_append(char **end, char *limit, const char *s)
+{
+    while (*s != '\0' && *end < limit)
+    {
+        *(*end)++ = *s++;
+    }
+}
+
+/** Appends value in the given base, 10 or 16, to the buffer at *end. */
+static void flight_append_number(char **end, char *limit, uint64_t value, int base)
+{
+    char digits[24];
+    int n = 0;
+    do
+    {
+        digits[n++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value != 0);
+
+    while (n > 0 && *end < limit)
+    {
+        *(*end)++ = digits[--n];
+    }
+}
+
+int mm_flight_events(FlightEvent *events, int max)
+{
+    uint64_t count = (flight_count < FLIGHT_EVENTS) ? flight_count : FLIGHT_EVENTS;
+    if (count > (uint64_t)max)
+    {
+        count = max;
+    }
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        events[i] = flight_event(flight_count - count + i);
+    }
+    return count;
+}
+
+void mm_flight_dump(int fd)
+{
+    static const char *op_names[] = {"alloc", "free", "split", "coalesce", "grow"};
+    uint64_t count = (flight_count < FLIGHT_EVENTS) ? flight_count : FLIGHT_EVENTS;
+    char line[128];
+    char *end = line;
+    char *limit = line + sizeof(line) - 1;
+
+    flight_append(&end, limit, "flight recorder: last ");
+    flight_append_number(&end, limit, count, 10);
+    flight_append(&end, limit, " events, oldest first, numbered back from the newest");
+    *end++ = '\n';
+    write(fd, line, end - line);
+
+    for (uint64_t i = flight_count - count; i < flight_count; i++)
+    {
+        FlightEvent event = flight_event(i);
+        end = line;
+        flight_append(&end, limit, "  ");
+        flight_append_number(&end, limit, flight_count - 1 - event.seq, 10);
+        flight_append(&end, limit, "\t");
+        flight_append(&end, limit, ((unsigned)event.op < sizeof(op_names) / sizeof(op_names[0])) ? op_names[event.op] : "?");
+        flight_append(&end, limit, "\t0x");
+        flight_append_number(&end, limit, (uintptr_t)event.addr, 16);
+        flight_append(&end, limit, (event.size < 0) ? "\t-" : "\t");
+        flight_append_number(&end, limit, labs(event.size), 10);
+        *end++ = '\n';
+        write(fd, line, end - line);
+    }
+}
+#else
+int mm_flight_events(FlightEvent *events, int max)
+{
+    return 0;
+}
+
+void mm_flight_dump(int fd)
+{
+    static const char off[] = "flight recorder: built with FLIGHT_RECORDER=0\n";
+    write(fd, off, sizeof(off) - 1);
+}
+#endif
+
+/*********************************************/
+/*************** Backend Heap  ***************/
+/*********************************************/
+
+int mm_init()
+{
+    // forget the blocks of the previous heap
+    memset(block_start_bits, 0, bitmap_bytes());
+    memset(mark_bits, 0, bitmap_bytes());
+    memset(nursery_start_bits, 0, bitmap_bytes());
+    gc_phase = GC_IDLE;
+    mark_stack_top = 0;
+    gc_roots = NULL;
+    gc_num_roots = 0;
+    sweep_cursor = NULL;
+    num_registered_roots = 0;
+    stack_base = NULL;
+    nursery_block = NULL;
+    nursery_lo = NULL;
+    nursery_top = NULL;
+    nursery_hi = NULL;
+    clear_cards();
+    allocated_since_gc = 0;
+    gc_assist_ns = 0;
+    marked_bytes = 0;
+    live_bytes = 0;
+    if (num_sampled_blocks > 0)
+    {
+        forget_sampled_blocks();
+    }
+
+    free_list_head = NULL;
+    malloc_list_tail = NULL;
+    heap_size = 0;
+
+    return 0;
+}
+
+void *requestMoreSpace(size_t reqSize)
+{
+    PROFILE_ENTER(PROFILE_GROW);
+    void *ret = UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size);
+    heap_size += reqSize;
+
+    void *mem_sbrk_result = mem_sbrk(reqSize);
+    if ((size_t)mem_sbrk_result == -1)
+    {
+        printf("ERROR: mem_sbrk failed in requestMoreSpace\n");
+        exit(0);
+    }
+
+    FLIGHT_RECORD(FLIGHT_GROW, ret, reqSize);
+    PROFILE_LEAVE(PROFILE_GROW);
+    return ret;
+}
+
+void releaseSpace(size_t size)
+{
+    heap_size -= size;
+
+    if ((size_t)mem_trim(size) == -1)
+    {
+        printf("ERROR: mem_trim failed in releaseSpace\n");
+        exit(0);
+    }
+}
+
+Block *first_block()
+{
+    // first address in the heap
+    Block *first = (Block *)mem_heap_lo();
+    if (heap_size == 0)
+    {
+        return NULL;
+    }
+
+    return first;
+}
+
+Block *next_block(Block *block)
+{
+    size_t distance = (block->info.size > 0) ? block->info.size : -block->info.size;
+
+    // last address in the heap
+    Block *end = (Block *)UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size);
+    Block *next = (Block *)UNSCALED_POINTER_ADD(block, sizeof(BlockInfo) + distance);
+    if (next >= end)
+    {
+        return NULL;
+    }
+
+    return next;
+}
+
+
+/*********************************************/
+/************ Garbage Collection *************/
+/*********************************************/
+
+/** Marks the block and pushes it onto the mark stack. */
+static void push_grey(Block *block)
+{
+    set_bit(mark_bits, granule_of(block));
+    marked_bytes += INFO_SIZE + labs(block->info.size);
+
+    mark_stack = grow_array(mark_stack, mark_stack_top, &mark_stack_capacity, sizeof(Block *));
+    mark_stack[mark_stack_top++] = block;
+}
+
+#if defined(__linux__)
+/** First byte of .data and the end of .bss, provided by the GNU linker. */
+extern char __data_start[];
+extern char _end[];
+#endif
+
+/**
+ * Shades every word between lo and hi that falls inside the heap, or with
+ * shading off only reports whether one of them points at a young block.
+ */
+static int __attribute__((no_sanitize_address)) scan_range(void *lo, void *hi, int shading)
+{
+    char *heap_lo = (char *)mem_heap_lo();
+    char *heap_hi = heap_lo + heap_size;
+    void **word = (void **)(((uintptr_t)lo + WORD_SIZE - 1) & ~(uintptr_t)(WORD_SIZE - 1));
+
+    for (; (void *)(word + 1) <= hi; word++)
+    {
+        // the common non-pointer word is rejected by two compares
+        if ((char *)*word >= heap_lo && (char *)*word < heap_hi)
+        {
+            if (shading)
+            {
+                gc_shade(*word);
+
+                // roots found by scanning cannot be updated either
+                Block *target;
+                if (gc_compacting && (target = gc_find_block(*word)) != NULL)
+                {
+                    set_bit(pin_bits, granule_of(target));
+                }
+            }
+            else if (gc_find_young(*word) != NULL)
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Scans the spilled registers and the stack between this frame and the
+ * stack base. Kept out of line so its frame lies below every caller's.
+ */
+static int __attribute__((noinline)) scan_stack(int shading)
+{
+    jmp_buf registers;
+    setjmp(registers);
+    if (scan_range(&registers, (char *)&registers + sizeof(registers), shading))
+    {
+        return 1;
+    }
+
+    char *sp = (char *)__builtin_frame_address(0);
+    if (sp < (char *)stack_base)
+    {
+        return scan_range(sp, stack_base, shading);
+    }
+    return scan_range(stack_base, sp, shading);
+}
+
+/** Scans .data and .bss, skipping the collector's own tables. */
+static int scan_data_segment(int shading)
+{
+#if defined(__linux__)
+    struct
+    {
+        char *lo;
+        char *hi;
+    } tables[] = {
+        {(char *)block_start_bits, (char *)block_start_bits + sizeof(block_start_bits)},
+        {(char *)mark_bits, (char *)mark_bits + sizeof(mark_bits)},
+        {(char *)block_layouts, (char *)block_layouts + sizeof(block_layouts)},
+        {(char *)layouts, (char *)layouts + sizeof(layouts)},
+        {(char *)pin_bits, (char *)pin_bits + sizeof(pin_bits)},
+        {(char *)nursery_start_bits, (char *)nursery_start_bits + sizeof(nursery_start_bits)},
+        {(char *)cards, (char *)cards + sizeof(cards)},
+        {(char *)sample_sites, (char *)sample_sites + sizeof(sample_sites)},
+        {(char *)sampled_blocks, (char *)sampled_blocks + sizeof(sampled_blocks)}};
+    size_t num_tables = sizeof(tables) / sizeof(tables[0]);
+
+    // visit the tables in address order and scan the gaps between them
+    char *next = __data_start;
+    for (size_t visited = 0; visited < num_tables; visited++)
+    {
+        size_t lowest = 0;
+        for (size_t i = 1; i < num_tables; i++)
+        {
+            if (tables[i].lo < tables[lowest].lo)
+            {
+                lowest = i;
+            }
+        }
+
+        if (tables[lowest].lo > next && scan_range(next, tables[lowest].lo, shading))
+        {
+            return 1;
+        }
+        if (tables[lowest].hi > next)
+        {
+            next = tables[lowest].hi;
+        }
+        tables[lowest].lo = (char *)UINTPTR_MAX;
+    }
+
+    if (next < _end)
+    {
+        return scan_range(next, _end, shading);
+    }
+#endif
+    return 0;
+}
+
+/** Shades every root of the current cycle and every registered root. */
+static void shade_roots()
+{
+    for (size_t i = 0; i < gc_num_roots; i++)
+    {
+        gc_shade(gc_roots[i]);
+    }
+
+    for (size_t i = 0; i < num_registered_roots; i++)
+    {
+        gc_shade(*registered_roots[i]);
+    }
+
+    // the nursery is scanned as one old block that is always live
+    if (nursery_block != NULL && !test_bit(mark_bits, granule_of(nursery_block)))
+    {
+        push_grey(nursery_block);
+    }
+
+    if (stack_base != NULL)
+    {
+        scan_stack(1);
+        scan_data_segment(1);
+    }
+}
+
+/**
+ * Scans grey blocks until the mark stack is empty or budget words of
+ * work were done. Returns the work done.
+ */
+static size_t drain_mark_stack(size_t budget)
+{
+    size_t work = 0;
+
+    while (work < budget && mark_stack_top > 0)
+    {
+        Block *block = mark_stack[--mark_stack_top];
+
+        // skip blocks the program freed after they were shaded
+        if (!test_bit(block_start_bits, granule_of(block)) || block->info.size <= 0)
+        {
+            continue;
+        }
+
+        work += 1 + gc_scan_block(block);
+    }
+
+    return work;
+}
+
+void mm_garbage_collect(void **roots, size_t num_roots)
+{
+    mm_gc_start(roots, num_roots);
+
+    // an unbounded budget finishes the cycle in one step
+    while (!mm_gc_step(SIZE_MAX))
+    {
+    }
+}
+
+void mm_gc_start(void **roots, size_t num_roots)
+{
+    // a running cycle picks the new roots up when it rescans them
+    gc_roots = roots;
+    gc_num_roots = num_roots;
+    if (gc_phase == GC_MARKING)
+    {
+        return;
+    }
+
+    // the marks of the last cycle are still needed by its sweep
+    if (gc_phase == GC_SWEEPING)
+    {
+        gc_sweep(0, SIZE_MAX);
+    }
+
+    // every block starts out white
+    memset(mark_bits, 0, bitmap_bytes());
+    mark_stack_top = 0;
+    marked_bytes = 0;
+    allocated_since_gc = 0;
+    gc_phase = GC_MARKING;
+
+    shade_roots();
+}
+
+int mm_gc_step(size_t budget)
+{
+    if (gc_phase == GC_IDLE)
+    {
+        return 1;
+    }
+
+    if (gc_phase == GC_SWEEPING)
+    {
+        gc_sweep(0, budget);
+        return gc_phase == GC_IDLE;
+    }
+
+    size_t work = drain_mark_stack(budget);
+    if (mark_stack_top > 0)
+    {
+        return 0;
+    }
+
+    // roots are written without a barrier, so rescan them before finishing
+    shade_roots();
+    if (mark_stack_top > 0)
+    {
+        return 0;
+    }
+
+    // hand the rest of the budget to the lazy sweep; an unbounded one
+    // stays unbounded, so the sweep may run to the end in parallel
+    live_bytes = marked_bytes;
+    gc_phase = GC_SWEEPING;
+    sweep_cursor = first_block();
+    if (budget != SIZE_MAX)
+    {
+        budget = (work < budget) ? budget - work : 0;
+    }
+    gc_sweep(0, budget);
+
+    return gc_phase == GC_IDLE;
+}
+
+void mm_gc_set_stack_base(void *base)
+{
+    stack_base = base;
+}
+
+void mm_gc_set_percent(int percent)
+{
+    gc_percent = (percent < 0) ? GC_PERCENT_OFF : percent;
+}
+
+void mm_gc_set_soft_limit(size_t bytes)
+{
+    gc_soft_limit = bytes;
+}
+
+uint64_t mm_gc_assist_ns()
+{
+    return gc_assist_ns;
+}
+
+size_t mm_gc_parallel_sweeps()
+{
+    return parallel_sweeps;
+}
+
+void mm_gc_set_sweep_threads(int threads)
+{
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    sweep_threads = (threads > GC_MAX_SWEEP_THREADS) ? GC_MAX_SWEEP_THREADS : threads;
+}
+
+void mm_gc_write_barrier(void *obj, void **field, void *newval)
+{
+    // the insertion barrier only needs the new target, not obj
+    if (gc_phase == GC_MARKING)
+    {
+        gc_shade(newval);
+    }
+
+    // remember old-to-young pointers for the next minor collection
+    char *lo = (char *)mem_heap_lo();
+    if (in_nursery(newval) && !in_nursery(field) &&
+        (char *)field >= lo && (char *)field < lo + heap_size)
+    {
+        size_t card = ((char *)field - lo) / GC_CARD_SIZE;
+        if (!cards[card])
+        {
+            cards[card] = 1;
+            dirty_cards = grow_array(dirty_cards, num_dirty_cards, &dirty_cards_capacity, sizeof(size_t));
+            dirty_cards[num_dirty_cards++] = card;
+        }
+    }
+
+    *field = newval;
+}
+
+void mm_gc_register_root(void **slot)
+{
+    registered_roots = grow_array(registered_roots, num_registered_roots,
+                                  &registered_roots_capacity, sizeof(void **));
+    registered_roots[num_registered_roots++] = slot;
+}
+
+void mm_gc_unregister_root(void **slot)
+{
+    for (size_t i = 0; i < num_registered_roots; i++)
+    {
+        if (registered_roots[i] == slot)
+        {
+            registered_roots[i] = registered_roots[--num_registered_roots];
+            return;
+        }
+    }
+}
+
+/**
+ * Returns where ptr points once its block has moved to the forwarding
+ * address mm_gc_compact stored in the block's prev link.
+ */
+static void *forward_pointer(void *ptr)
+{
+    Block *block = gc_find_block(ptr);
+
+    if (block == NULL || !test_bit(mark_bits, granule_of(block)))
+    {
+        return ptr;
+    }
+
+    return UNSCALED_POINTER_ADD(block->info.prev, (char *)ptr - (char *)block);
+}
+
+/**
+ * Replaces every pointer slot of a typed block that lies between lo and
+ * hi with the address forward returns for it.
+ */
+static void forward_slots(Block *block, void *lo, void *hi, void *(*forward)(void *))
+{
+    uint8_t layout_id = block_layouts[granule_of(block)];
+    if (layout_id == GC_LAYOUT_CONSERVATIVE)
+    {
+        return;
+    }
+
+    void **payload = (void **)UNSCALED_POINTER_ADD(block, INFO_SIZE);
+    size_t words = block->info.size / WORD_SIZE;
+    Layout *layout = &layouts[layout_id];
+    size_t element_words = layout->size / WORD_SIZE;
+    for (size_t base = 0; base + element_words <= words; base += element_words)
+    {
+        for (uint64_t bits = layout->pointers; bits != 0; bits &= bits - 1)
+        {
+            void **slot = &payload[base + __builtin_ctzll(bits)];
+            if ((void *)slot >= lo && (void *)slot < hi)
+            {
+                *slot = forward(*slot);
+            }
+        }
+    }
+}
+
+/**
+ * Turns the space between the end of last and next into a free block.
+ * A hole too small to hold a free block is added to last instead.
+ * Returns the block that now ends at next.
+ */
+static Block *fill_hole(Block *last, void *hole, Block *next)
+{
+    size_t gap = (char *)next - (char *)hole;
+
+    if (gap < INFO_SIZE + FREE_INFO_SIZE)
+    {
+        last->info.size += gap;
+        return last;
+    }
+
+    Block *block = (Block *)hole;
+    block->info.size = -(long int)(gap - INFO_SIZE);
+    block->info.prev = last;
+    set_bit(block_start_bits, granule_of(block));
+    add_to_free_list(block);
+
+    return block;
+}
+
+static inline int is_live(Block *block)
+{
+    return block->info.size > 0 && test_bit(mark_bits, granule_of(block));
+}
+
+void mm_gc_compact()
+{
+    // finish any cycle in flight and empty the nursery, then mark from
+    // the registered and scanned roots only
+    while (!mm_gc_step(SIZE_MAX))
+    {
+    }
+    mm_gc_minor();
+
+    memset(mark_bits, 0, bitmap_bytes());
+    memset(pin_bits, 0, bitmap_bytes());
+    gc_roots = NULL;
+    gc_num_roots = 0;
+    marked_bytes = 0;
+    gc_compacting = 1;
+    gc_phase = GC_MARKING;
+
+    shade_roots();
+    drain_mark_stack(SIZE_MAX);
+
+    gc_compacting = 0;
+    gc_phase = GC_IDLE;
+    live_bytes = marked_bytes;
+    allocated_since_gc = 0;
+
+    // the nursery's bounds are kept in pointers, so it stays put
+    if (nursery_block != NULL)
+    {
+        set_bit(pin_bits, granule_of(nursery_block));
+    }
+
+    // compute forwarding addresses, sliding movable blocks toward the bottom
+    char *free_ptr = (char *)mem_heap_lo();
+    for (Block *curr = first_block(); curr != NULL; curr = next_block(curr))
+    {
+        if (!is_live(curr))
+        {
+            continue;
+        }
+
+        if (test_bit(pin_bits, granule_of(curr)))
+        {
+            curr->info.prev = curr;
+            free_ptr = (char *)UNSCALED_POINTER_ADD(curr, INFO_SIZE + curr->info.size);
+        }
+        else
+        {
+            curr->info.prev = (Block *)free_ptr;
+            free_ptr += INFO_SIZE + curr->info.size;
+        }
+    }
+
+    // update references while the old headers can still be found
+    for (Block *curr = first_block(); curr != NULL; curr = next_block(curr))
+    {
+        if (is_live(curr))
+        {
+            forward_slots(curr, mem_heap_lo(), UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size), forward_pointer);
+        }
+    }
+
+    for (size_t i = 0; i < num_registered_roots; i++)
+    {
+        *registered_roots[i] = forward_pointer(*registered_roots[i]);
+    }
+
+    // slide the blocks, rebuilding the block list and free list as we go
+    Block *curr = first_block();
+    Block *last = NULL;
+    free_ptr = (char *)mem_heap_lo();
+    memset(block_start_bits, 0, bitmap_bytes());
+    free_list_head = NULL;
+
+    while (curr != NULL)
+    {
+        Block *next = next_block(curr);
+
+        if (is_live(curr))
+        {
+            Block *dest = curr->info.prev;
+            uint8_t layout_id = block_layouts[granule_of(curr)];
+
+            // a pinned block leaves a hole behind the blocks slid before it
+            if ((char *)dest > free_ptr)
+            {
+                last = fill_hole(last, free_ptr, dest);
+            }
+
+            memmove(dest, curr, INFO_SIZE + curr->info.size);
+            dest->info.prev = last;
+            if (num_sampled_blocks > 0)
+            {
+                sample_move(UNSCALED_POINTER_ADD(curr, INFO_SIZE), UNSCALED_POINTER_ADD(dest, INFO_SIZE));
+            }
+            set_bit(block_start_bits, granule_of(dest));
+            block_layouts[granule_of(dest)] = layout_id;
+
+            last = dest;
+            free_ptr = (char *)UNSCALED_POINTER_ADD(dest, INFO_SIZE + dest->info.size);
+        }
+        else if (curr->info.size > 0 && num_sampled_blocks > 0)
+        {
+            // garbage is reclaimed without mm_free, which would unsample it
+            sample_free(UNSCALED_POINTER_ADD(curr, INFO_SIZE));
+        }
+
+        curr = next;
+    }
+
+    // give the tail past the last live block back
+    memset(mark_bits, 0, bitmap_bytes());
+    malloc_list_tail = last;
+    releaseSpace(((char *)mem_heap_lo() + heap_size) - free_ptr);
+
+#if DEBUG
+    // DEBUG
+    check_heap();
+#endif
+}
+
+/** Carves a nursery with room for size bytes of young blocks out of the heap. */
+static void new_nursery(size_t size)
+{
+    // the spare slot lets the nursery's header become a free block later
+    void *payload = mm_malloc(size + FREE_INFO_SIZE);
+
+    nursery_block = (Block *)UNSCALED_POINTER_SUB(payload, INFO_SIZE);
+    nursery_lo = (char *)UNSCALED_POINTER_ADD(payload, FREE_INFO_SIZE);
+    nursery_top = nursery_lo;
+    nursery_hi = (char *)UNSCALED_POINTER_ADD(payload, nursery_block->info.size);
+}
+
+/** Bumps a young block for the given typed request. */
+static void *nursery_malloc(size_t size, int layout_id)
+{
+    long int reqSize = FREE_INFO_SIZE * ((size + FREE_INFO_SIZE - 1) / FREE_INFO_SIZE);
+
+    if (nursery_top + INFO_SIZE + reqSize > nursery_hi)
+    {
+        mm_gc_minor();
+    }
+
+    Block *block = (Block *)nursery_top;
+    block->info.size = reqSize;
+    block->info.prev = NULL; // not promoted yet
+    set_bit(nursery_start_bits, granule_of(block));
+    block_layouts[granule_of(block)] = layout_id;
+    nursery_top += INFO_SIZE + reqSize;
+
+    return UNSCALED_POINTER_ADD(block, INFO_SIZE);
+}
+
+/**
+ * Visits the old blocks overlapping a dirty card. When promoting, the
+ * pointer slots of typed blocks inside the card are forwarded. Otherwise
+ * returns 1 if a word of an untyped block inside the card points at a
+ * young block, which then cannot be moved.
+ */
+static int scan_card(size_t card, int promoting)
+{
+    char *card_lo = (char *)UNSCALED_POINTER_ADD(mem_heap_lo(), card * GC_CARD_SIZE);
+    char *card_hi = card_lo + GC_CARD_SIZE;
+
+    Block *block = find_header(block_start_bits, granule_of(card_lo), 0);
+    for (; block != NULL && (char *)block < card_hi; block = next_block(block))
+    {
+        if (block->info.size <= 0 || block == nursery_block)
+        {
+            continue;
+        }
+
+        if (promoting)
+        {
+            forward_slots(block, card_lo, card_hi, gc_promote);
+        }
+        else if (block_layouts[granule_of(block)] == GC_LAYOUT_CONSERVATIVE)
+        {
+            void **payload = (void **)UNSCALED_POINTER_ADD(block, INFO_SIZE);
+            for (size_t i = 0; i < block->info.size / WORD_SIZE; i++)
+            {
+                if ((char *)&payload[i] >= card_lo && (char *)&payload[i] < card_hi &&
+                    gc_find_young(payload[i]) != NULL)
+                {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Turns the nursery into ordinary old blocks in place: every young block
+ * becomes an allocated block and the unused tail becomes a free block.
+ * Unreachable young blocks are left to the next major collection.
+ */
+static void retire_nursery()
+{
+    Block *after = next_block(nursery_block);
+    Block *last = nursery_block;
+
+    // the spare slot keeps the nursery's header a valid free block
+    nursery_block->info.size = -(long int)FREE_INFO_SIZE;
+    add_to_free_list(nursery_block);
+
+    for (char *p = nursery_lo; p < nursery_top; p += INFO_SIZE + ((Block *)p)->info.size)
+    {
+        Block *block = (Block *)p;
+        block->info.prev = last;
+        set_bit(block_start_bits, granule_of(block));
+        clear_bit(nursery_start_bits, granule_of(block));
+
+        // a running cycle has to see what the retired blocks point at
+        if (gc_phase == GC_MARKING)
+        {
+            push_grey(block);
+        }
+        else if (gc_phase == GC_SWEEPING)
+        {
+            set_bit(mark_bits, granule_of(block));
+        }
+
+        last = block;
+    }
+
+    Block *tail = NULL;
+    size_t gap = nursery_hi - nursery_top;
+    if (gap >= INFO_SIZE + FREE_INFO_SIZE)
+    {
+        tail = (Block *)nursery_top;
+        tail->info.size = -(long int)(gap - INFO_SIZE);
+        tail->info.prev = last;
+        set_bit(block_start_bits, granule_of(tail));
+        add_to_free_list(tail);
+        last = tail;
+    }
+    else if (gap > 0)
+    {
+        last->info.size += gap;
+    }
+
+    if (after != NULL)
+    {
+        after->info.prev = last;
+    }
+    else
+    {
+        malloc_list_tail = last;
+    }
+
+    if (tail != NULL)
+    {
+        coalesce(tail);
+    }
+    coalesce(nursery_block);
+}
+
+int mm_gc_enable_nursery(size_t size)
+{
+    if (nursery_block != NULL || size < INFO_SIZE + FREE_INFO_SIZE)
+    {
+        fprintf(stderr, "mm_gc_enable_nursery(): Cannot enable a nursery of %zu bytes.", size);
+        return -1;
+    }
+
+    new_nursery(FREE_INFO_SIZE * ((size + FREE_INFO_SIZE - 1) / FREE_INFO_SIZE));
+
+    return 0;
+}
+
+void mm_gc_minor()
+{
+    if (nursery_block == NULL)
+    {
+        return;
+    }
+
+    gc_in_minor = 1;
+
+    // a conservative reference cannot be forwarded and pins the nursery
+    int pinned = 0;
+    for (size_t i = 0; i < gc_num_roots && !pinned; i++)
+    {
+        pinned = gc_find_young(gc_roots[i]) != NULL;
+    }
+    for (size_t i = 0; i < num_dirty_cards && !pinned; i++)
+    {
+        pinned = scan_card(dirty_cards[i], 0);
+    }
+    if (stack_base != NULL && !pinned)
+    {
+        pinned = scan_stack(0) || scan_data_segment(0);
+    }
+
+    if (pinned)
+    {
+        size_t size = nursery_hi - nursery_lo;
+        retire_nursery();
+        new_nursery(size);
+        clear_cards();
+        gc_in_minor = 0;
+        return;
+    }
+
+    // promote everything reachable from the roots and the dirty cards
+    for (size_t i = 0; i < num_registered_roots; i++)
+    {
+        *registered_roots[i] = gc_promote(*registered_roots[i]);
+    }
+    for (size_t i = 0; i < num_dirty_cards; i++)
+    {
+        scan_card(dirty_cards[i], 1);
+    }
+
+    // then everything reachable from the promoted blocks
+    while (num_promoted > 0)
+    {
+        Block *block = promoted[--num_promoted];
+        forward_slots(block, mem_heap_lo(), UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size), gc_promote);
+
+        // promoted blocks are black, so shade what they point at
+        if (gc_phase == GC_MARKING)
+        {
+            gc_scan_block(block);
+        }
+    }
+
+    // start over with an empty nursery
+    for (char *p = nursery_lo; p < nursery_top; p += INFO_SIZE + ((Block *)p)->info.size)
+    {
+        clear_bit(nursery_start_bits, granule_of(p));
+    }
+    nursery_top = nursery_lo;
+    clear_cards();
+    gc_in_minor = 0;
+
+#if DEBUG
+    // DEBUG
+    check_heap();
+#endif
+}
+
+Block *gc_find_young(void *ptr)
+{
+    if (nursery_block == NULL || (char *)ptr < nursery_lo + INFO_SIZE || (char *)ptr >= nursery_top)
+    {
+        return NULL;
+    }
+
+    Block *block = find_header(nursery_start_bits, granule_of(UNSCALED_POINTER_SUB(ptr, INFO_SIZE)),
+                               granule_of(nursery_lo));
+    if (block == NULL || (char *)ptr >= (char *)UNSCALED_POINTER_ADD(block, INFO_SIZE + block->info.size))
+    {
+        return NULL;
+    }
+
+    return block;
+}
+
+void *gc_promote(void *ptr)
+{
+    Block *young = gc_find_young(ptr);
+    if (young == NULL)
+    {
+        return ptr;
+    }
+
+    // the prev link of a promoted block holds its old-generation copy
+    if (young->info.prev == NULL)
+    {
+        void *payload = mm_malloc(young->info.size);
+        Block *old = (Block *)UNSCALED_POINTER_SUB(payload, INFO_SIZE);
+
+        memcpy(payload, UNSCALED_POINTER_ADD(young, INFO_SIZE), young->info.size);
+        block_layouts[granule_of(old)] = block_layouts[granule_of(young)];
+        young->info.prev = old;
+
+        promoted = grow_array(promoted, num_promoted, &promoted_capacity, sizeof(Block *));
+        promoted[num_promoted++] = old;
+    }
+
+    return UNSCALED_POINTER_ADD(young->info.prev, (char *)ptr - (char *)young);
 }
 
-void split(Block *block, size_t reqSize)
+int mm_gc_register_layout(size_t size, uint64_t pointers)
 {
-    // create a new block
-    Block *new = (Block *)UNSCALED_POINTER_ADD(block, INFO_SIZE + reqSize);
-    new->info.prev = block;
-    new->info.size = -(labs(block->info.size) - (INFO_SIZE + reqSize)); // already aligned
+    // round partial trailing words up to a whole word
+    size_t words = (size + WORD_SIZE - 1) / WORD_SIZE;
 
-    // add to lists
-    add_to_free_list(new);
-    Block *next = next_block(block);
-    if (next != NULL)
+    if (words == 0 || words > GC_LAYOUT_MAX_WORDS || num_layouts == GC_MAX_LAYOUTS)
     {
-        next->info.prev = new;
+        fprintf(stderr, "mm_gc_register_layout(): Cannot register a layout of %zu bytes.", size);
+        return -1;
     }
-    else
+
+    // ignore bits past the end of the element
+    if (words < 64)
     {
-        malloc_list_tail = new;
+        pointers &= ((uint64_t)1 << words) - 1;
     }
 
-    // update previous block's size
-    block->info.size = -reqSize;
+    layouts[num_layouts].size = words * WORD_SIZE;
+    layouts[num_layouts].pointers = pointers;
 
-#if DEBUG
-    // DEBUG
-    check_heap();
-#endif
+    return num_layouts++;
 }
 
-/*********************************************/
-/*********** Linked List Functions ***********/
-/*********************************************/
-
-void insert_at_tail(Block *block)
+void *mm_malloc_typed(size_t size, int layout_id)
 {
-    block->info.prev = malloc_list_tail;
-    malloc_list_tail = block;
+    if (layout_id < 0 || layout_id >= num_layouts)
+    {
+        fprintf(stderr, "mm_malloc_typed(): Layout %d is not registered.", layout_id);
+        return NULL;
+    }
 
-#if DEBUG
-    // DEBUG
-    check_heap();
-#endif
+    // small typed blocks are bumped in the nursery; the rest start out old
+    if (nursery_block != NULL && layout_id != GC_LAYOUT_CONSERVATIVE && size > 0 &&
+        size <= (size_t)(nursery_hi - nursery_lo) / GC_NURSERY_LARGE_FRACTION)
+    {
+        return nursery_malloc(size, layout_id);
+    }
+
+    void *ptr = mm_malloc(size);
+    if (ptr != NULL)
+    {
+        block_layouts[granule_of(UNSCALED_POINTER_SUB(ptr, INFO_SIZE))] = layout_id;
+    }
+
+    return ptr;
 }
 
-void add_to_free_list(Block *block)
+Block *gc_find_block(void *ptr)
 {
-    // empty list
-    if (free_list_head == NULL)
+    char *lo = (char *)mem_heap_lo();
+
+    // most words are not heap addresses and fail one of these two compares
+    if ((char *)ptr < lo + INFO_SIZE || (char *)ptr >= lo + heap_size)
     {
-        block->freeNode.nextFree = NULL;
-        block->freeNode.prevFree = NULL;
-        free_list_head = block;
+        return NULL;
     }
 
-    // append to the beginning of the list
-    else
+    // find the closest block header at least a header below ptr
+    Block *block = find_header(block_start_bits, granule_of(UNSCALED_POINTER_SUB(ptr, INFO_SIZE)), 0);
+
+    // ptr must land inside the payload of an allocated block
+    if (block == NULL || block->info.size <= 0 ||
+        (char *)ptr >= (char *)UNSCALED_POINTER_ADD(block, INFO_SIZE + block->info.size))
     {
-        free_list_head->freeNode.prevFree = block;
-        block->freeNode.nextFree = free_list_head;
-        block->freeNode.prevFree = NULL;
-        free_list_head = block;
+        return NULL;
     }
 
-#if DEBUG
-    // DEBUG
-    check_heap();
-#endif
+    return block;
 }
 
-void remove_from_free_list(Block *block)
+void gc_shade(void *ptr)
 {
-    Block *prev = block->freeNode.prevFree;
-    Block *next = block->freeNode.nextFree;
+    Block *block = gc_find_block(ptr);
 
-    // set the previous' next to the previous
-    if (prev != NULL)
+    if (block != NULL && !test_bit(mark_bits, granule_of(block)))
     {
-        prev->freeNode.nextFree = next;
+        push_grey(block);
     }
-    else // update head of the list
+}
+
+size_t gc_scan_block(Block *block)
+{
+    void **payload = (void **)UNSCALED_POINTER_ADD(block, INFO_SIZE);
+    size_t words = block->info.size / WORD_SIZE;
+    uint8_t layout_id = block_layouts[granule_of(block)];
+
+    // nothing past the bump pointer has been written yet
+    if (block == nursery_block)
     {
-        free_list_head = next;
+        words = (nursery_top - (char *)payload) / WORD_SIZE;
     }
 
-    // set the next's previous to the previous
-    if (next != NULL)
+    // conservatively treat every word as a possible pointer
+    if (layout_id == GC_LAYOUT_CONSERVATIVE)
     {
-        next->freeNode.prevFree = prev;
+        for (size_t i = 0; i < words; i++)
+        {
+            gc_shade(payload[i]);
+
+            // a word that cannot be updated keeps its target in place
+            Block *target;
+            if (gc_compacting && (target = gc_find_block(payload[i])) != NULL)
+            {
+                set_bit(pin_bits, granule_of(target));
+            }
+        }
+
+        return words;
     }
 
-#if DEBUG
-    // DEBUG
-    check_heap();
-#endif
-}
+    // visit only the pointer slots of each whole element in the payload
+    Layout *layout = &layouts[layout_id];
+    size_t element_words = layout->size / WORD_SIZE;
+    size_t scanned = 0;
+    for (size_t base = 0; base + element_words <= words; base += element_words)
+    {
+        for (uint64_t bits = layout->pointers; bits != 0; bits &= bits - 1)
+        {
+            gc_shade(payload[base + __builtin_ctzll(bits)]);
+            scanned++;
+        }
+    }
 
-/*********************************************/
-/*************** Inspect Heap  ***************/
-/*********************************************/
+    return scanned;
+}
 
-void examine_heap()
+/** Free blocks one task of a parallel sweep produced, in its segment. */
+typedef struct SweepSegment
 {
-    // print to stderr so output isn't buffered and not output if we crash
-    Block *curr = (Block *)mem_heap_lo();                                 // pointer to the current block
-    Block *end = (Block *)UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size); // pointer to the tail block
-    void *prev = NULL;
-
-    fprintf(stderr, "heap size:\t0x%lu\n", (long)heap_size);
-    fprintf(stderr, "heap start:\t%p\n", curr);
-    fprintf(stderr, "heap end:\t%p\n", end);
+    Block *first;
+    Block *free_head;
+    Block *free_tail;
+} SweepSegment;
 
-    fprintf(stderr, "free_list_head: %p\n", (void *)free_list_head);
+/** Work shared by the threads of a parallel sweep. */
+typedef struct ParallelSweep
+{
+    SweepSegment *segments;
+    size_t num_segments;
+    size_t lo_granule;
+    size_t next_segment;
+} ParallelSweep;
+
+/**
+ * Sweeps the blocks whose headers lie in one segment, merging each run
+ * of free blocks into its first block and linking the runs into the
+ * segment's own free list. Runs are not merged across segments and no
+ * shared list is touched, so segments can be swept concurrently.
+ */
+static void sweep_segment(ParallelSweep *sweep, size_t index)
+{
+    SweepSegment *segment = &sweep->segments[index];
+    size_t seg_granules = GC_SWEEP_SEGMENT / GC_GRANULE_SIZE;
+    size_t lo = index * seg_granules;
+    size_t hi = lo + seg_granules;
+    if (lo < sweep->lo_granule)
+    {
+        lo = sweep->lo_granule;
+    }
 
-    fprintf(stderr, "malloc_list_tail: %p\n", (void *)malloc_list_tail);
+    segment->first = find_next_header(block_start_bits, lo, hi);
+    segment->free_head = NULL;
+    segment->free_tail = NULL;
 
-    int all_correct = 1;
-    while (curr && curr < end)
+    char *seg_hi = (char *)UNSCALED_POINTER_ADD(mem_heap_lo(), hi * GC_GRANULE_SIZE);
+    Block *run = NULL;
+    Block *curr = segment->first;
+    while (curr != NULL && (char *)curr < seg_hi)
     {
-        // print out common block attributes
-        fprintf(stderr, "%p: %ld\t", (void *)curr, curr->info.size);
+        Block *next = next_block(curr);
 
-        // and allocated/free specific data
-        if (curr->info.size > 0)
+        if (curr->info.size > 0 && !test_bit(mark_bits, granule_of(curr)))
         {
-            fprintf(stderr, "ALLOCATED\tprev: %p", (void *)curr->info.prev);
+            curr->info.size *= -1;
         }
-        else
+
+        if (curr->info.size > 0)
         {
-            fprintf(stderr, "FREE\tnextFree: %p, prevFree: %p, prev: %p", (void *)curr->freeNode.nextFree, (void *)curr->freeNode.prevFree, (void *)curr->info.prev);
+            run = NULL;
         }
-
-        // verify previous pointers
-        if (curr->info.prev == prev)
+        else if (run == NULL)
         {
-            fprintf(stderr, " ✓\n");
+            // open a run and put it on the segment's list
+            run = curr;
+            run->freeNode.prevFree = segment->free_tail;
+            run->freeNode.nextFree = NULL;
+            if (segment->free_tail != NULL)
+            {
+                segment->free_tail->freeNode.nextFree = run;
+            }
+            else
+            {
+                segment->free_head = run;
+            }
+            segment->free_tail = run;
         }
         else
         {
-            fprintf(stderr, " ✗\n");
-            all_correct = 0;
+            run->info.size -= INFO_SIZE - curr->info.size;
+            clear_bit(block_start_bits, granule_of(curr));
         }
 
-        // move to next
-        prev = curr;
-        curr = next_block(curr);
-    }
-    fprintf(stderr, "END OF HEAP\n\n");
+        // the block after a merged run may lie in the next segment, whose
+        // thread only reads and writes its size
+        if (run != NULL && run != curr)
+        {
+            if (next != NULL)
+            {
+                next->info.prev = run;
+            }
+            else
+            {
+                malloc_list_tail = run;
+            }
+        }
 
-    if (!all_correct)
-    {
-        fprintf(stderr, "Not all pointers were correct.");
+        curr = next;
     }
-
-    examine_free_list();
-
-    fprintf(stderr, "\n");
 }
 
-void examine_free_list()
+/** Sweeps segments until none are left. */
+static void *sweep_worker(void *arg)
 {
-    Block *curr = free_list_head;
-    fprintf(stderr, "HEAD OF FREE LIST: ");
+    ParallelSweep *sweep = (ParallelSweep *)arg;
 
-    // print out links
-    while (curr)
+    size_t index;
+    while ((index = __atomic_fetch_add(&sweep->next_segment, 1, __ATOMIC_RELAXED)) < sweep->num_segments)
     {
-        fprintf(stderr, "-> %p ", curr);
-        curr = curr->freeNode.nextFree;
+        sweep_segment(sweep, index);
     }
+
+    return NULL;
 }
 
-int check_heap()
+/**
+ * Sweeps from the cursor to the end of the heap with sweep_threads
+ * threads, then splices the segments' free lists into the free list and
+ * merges the runs that meet at segment boundaries.
+ */
+static void sweep_parallel()
 {
-    Block *curr = (Block *)mem_heap_lo();
-    Block *end = (Block *)UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size);
-    Block *last = NULL;
-    long int free_count = 0;
+    ParallelSweep sweep;
+    size_t seg_granules = GC_SWEEP_SEGMENT / GC_GRANULE_SIZE;
+    sweep.lo_granule = granule_of(sweep_cursor);
+    sweep.num_segments = (heap_size / GC_GRANULE_SIZE + seg_granules - 1) / seg_granules;
+    sweep.next_segment = sweep.lo_granule / seg_granules;
+    sweep.segments = malloc(sweep.num_segments * sizeof(SweepSegment));
+    if (sweep.segments == NULL)
+    {
+        printf("ERROR: malloc failed in sweep_parallel\n");
+        exit(0);
+    }
+    size_t first_segment = sweep.next_segment;
+    parallel_sweeps++;
 
-    while (curr && curr < end)
+    // the segments rebuild the free list past the cursor from scratch
+    char *cursor = (char *)sweep_cursor;
+    for (Block *curr = free_list_head, *next; curr != NULL; curr = next)
     {
-        if (curr->info.prev != last)
+        next = curr->freeNode.nextFree;
+        if ((char *)curr >= cursor)
         {
-            examine_heap();
-            fprintf(stderr, "check_heap: Error: previous link not correct.\nCurr = %p, curr->prev = %p, previous = %p\n\n",
-                    curr, curr->info.prev, last);
+            remove_from_free_list(curr);
         }
+    }
+    sweep_cursor = NULL;
 
-        if (curr->info.size <= 0)
+    // the segments reclaim garbage without mm_free, and the sampler's
+    // tables are not shared with their threads, so unsample it here
+    for (int i = 0; i < HEAP_SAMPLE_LIVE && num_sampled_blocks > 0; i++)
+    {
+        // removing an entry shifts a later one into its slot
+        void *ptr;
+        while ((ptr = sampled_blocks[i].ptr) != NULL && (char *)ptr >= cursor &&
+               !test_bit(mark_bits, granule_of(UNSCALED_POINTER_SUB(ptr, INFO_SIZE))))
         {
-            // Free
-            free_count++;
+            sample_free(ptr);
         }
-
-        last = curr;
-        curr = next_block(curr);
     }
 
-    // check malloc list tail
-    if (last != malloc_list_tail)
+    pthread_t workers[GC_MAX_SWEEP_THREADS];
+    int num_workers = 0;
+    for (int i = 1; i < sweep_threads && (size_t)i < sweep.num_segments - first_segment; i++)
     {
-        fprintf(stderr, "check_heap: Error: malloc list tail incorrect\nCurrent Tail: %p, Correct Tail: %p",
-                malloc_list_tail, last);
+        if (pthread_create(&workers[num_workers], NULL, sweep_worker, &sweep) == 0)
+        {
+            num_workers++;
+        }
+    }
+    sweep_worker(&sweep);
+    for (int i = 0; i < num_workers; i++)
+    {
+        pthread_join(workers[i], NULL);
     }
 
-    curr = free_list_head;
-    last = NULL;
-    while (curr)
+    for (size_t i = first_segment; i < sweep.num_segments; i++)
     {
-        if (curr == last)
+        SweepSegment *segment = &sweep.segments[i];
+        if (segment->free_head == NULL)
         {
-            examine_heap();
-            fprintf(stderr, "check_heap: Error: free list is circular.\n\n");
+            continue;
         }
-        last = curr;
-        curr = curr->freeNode.nextFree;
-        if (free_count == 0)
+
+        segment->free_tail->freeNode.nextFree = free_list_head;
+        if (free_list_head != NULL)
         {
-            examine_heap();
-            fprintf(stderr, "check_heap: Error: free list has more items than expected.\n\n");
+            free_list_head->freeNode.prevFree = segment->free_tail;
         }
-        free_count--;
+        free_list_head = segment->free_head;
     }
 
-    return 0;
-}
-
-/*********************************************/
-/*************** Backend Heap  ***************/
-/*********************************************/
-
-int mm_init()
-{
-    free_list_head = NULL;
-    malloc_list_tail = NULL;
-    heap_size = 0;
+    // merging into the previous block keeps later segments' first blocks
+    // valid, so visit the boundaries from the top down
+    for (size_t i = sweep.num_segments; i-- > first_segment;)
+    {
+        Block *first = sweep.segments[i].first;
+        if (first != NULL && first->info.size < 0 &&
+            first->info.prev != NULL && first->info.prev->info.size < 0)
+        {
+            coalesce(first);
+        }
+    }
 
-    return 0;
+    free(sweep.segments);
 }
 
-void *requestMoreSpace(size_t reqSize)
+Block *gc_sweep(size_t reqSize, size_t budget)
 {
-    void *ret = UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size);
-    heap_size += reqSize;
+    Block *fit = NULL;
+    size_t visited = 0;
 
-    void *mem_sbrk_result = mem_sbrk(reqSize);
-    if ((size_t)mem_sbrk_result == -1)
+    // a sweep that runs to the end of the heap can be split among threads
+    if (reqSize == 0 && budget == SIZE_MAX && sweep_threads > 1 && sweep_cursor != NULL)
     {
-        printf("ERROR: mem_sbrk failed in requestMoreSpace\n");
-        exit(0);
+        sweep_parallel();
     }
 
-    return ret;
-}
-
-Block *first_block()
-{
-    // first address in the heap
-    Block *first = (Block *)mem_heap_lo();
-    if (heap_size == 0)
+    while (sweep_cursor != NULL && fit == NULL && visited < budget)
     {
-        return NULL;
-    }
+        Block *curr = sweep_cursor;
 
-    return first;
-}
+        if (curr->info.size > 0 && !test_bit(mark_bits, granule_of(curr)))
+        {
+            mm_free(UNSCALED_POINTER_ADD(curr, INFO_SIZE));
 
-Block *next_block(Block *block)
-{
-    size_t distance = (block->info.size > 0) ? block->info.size : -block->info.size;
+            // coalescing moved the cursor onto the block curr merged into
+            curr = sweep_cursor;
+            if (reqSize > 0 && -curr->info.size >= (long int)reqSize)
+            {
+                fit = curr;
+            }
+        }
 
-    // last address in the heap
-    Block *end = (Block *)UNSCALED_POINTER_ADD(mem_heap_lo(), heap_size);
-    Block *next = (Block *)UNSCALED_POINTER_ADD(block, sizeof(BlockInfo) + distance);
-    if (next >= end)
+        sweep_cursor = next_block(curr);
+        visited++;
+    }
+
+    if (sweep_cursor == NULL)
     {
-        return NULL;
+        gc_phase = GC_IDLE;
+
+#if DEBUG
+        // DEBUG
+        check_heap();
+#endif
     }
 
-    return next;
+    return fit;
 }
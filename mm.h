@@ -1,3 +1,5 @@
+#include <stddef.h>
+#include <stdint.h>
 
 #define UNSCALED_POINTER_ADD(p, x) ((void *)((char *)(p) + (x)))
 #define UNSCALED_POINTER_SUB(p, x) ((void *)((char *)(p) - (x)))
@@ -102,6 +104,22 @@ extern void *mm_malloc(size_t size);
 /* Deallocate the given pointer that was previously allocated by mm_malloc. */
 extern void mm_free(void *ptr);
 
+/**
+ * Resize the block at ptr to size bytes, keeping its contents up to the
+ * smaller of the two sizes. Shrinks and grows in place when it can.
+ * Behaves like mm_malloc when ptr is NULL and like mm_free when size is 0.
+ */
+extern void *mm_realloc(void *ptr, size_t size);
+
+/** Allocate a zeroed array of nmemb elements of size bytes each. */
+extern void *mm_calloc(size_t nmemb, size_t size);
+
+/**
+ * Allocate size bytes whose address is a multiple of alignment, which
+ * must be a power of two. The block is freed with mm_free.
+ */
+extern void *mm_memalign(size_t alignment, size_t size);
+
 /*********************************************/
 /**************** Searching  *****************/
 /*********************************************/
@@ -176,6 +194,149 @@ void examine_free_list();
 /** Checks the heap for any issues and prints out errors as it finds them. */
 int check_heap();
 
+/**
+ * A summary of the free blocks in the heap, for watching fragmentation
+ * build up over time.
+ */
+typedef struct _HeapStats
+{
+    /** Payload bytes of all free blocks together. */
+    size_t free_bytes;
+    /** Payload bytes of the largest free block. */
+    size_t largest_free;
+    /** Number of free blocks. */
+    size_t free_blocks;
+} HeapStats;
+
+/** Fills in stats from the free list, in time linear in its length. */
+void mm_heap_stats(HeapStats *stats);
+
+/** Phases of the allocator that are profiled when mm.c is built with PROFILE. */
+typedef enum
+{
+    /** searchFreeList, including the split of the block it finds. */
+    PROFILE_SEARCH,
+    /** split, including adding the remainder to the free list. */
+    PROFILE_SPLIT,
+    /** coalesce. */
+    PROFILE_COALESCE,
+    /** add_to_free_list. */
+    PROFILE_ADD_FREE,
+    /** requestMoreSpace. */
+    PROFILE_GROW,
+    PROFILE_NUM_PHASES
+} ProfilePhase;
+
+/** What the profile counted for one phase. */
+typedef struct _PhaseProfile
+{
+    /** Number of times the phase ran. */
+    uint64_t calls;
+    /** Cycles spent in it, including the phases it calls. */
+    uint64_t cycles;
+    /** Blocks it examined, which only searches count. */
+    uint64_t examined;
+} PhaseProfile;
+
+/**
+ * Copies what was counted since the last mm_profile_reset into profile
+ * and returns 1, or returns 0 if mm.c was built without PROFILE.
+ */
+int mm_profile(PhaseProfile profile[PROFILE_NUM_PHASES]);
+
+/** Zeroes the counts of every phase. */
+void mm_profile_reset();
+
+/**
+ * Events each thread's flight recorder keeps. The recorder is on unless
+ * mm.c is built with FLIGHT_RECORDER=0.
+ */
+#define FLIGHT_EVENTS 256
+
+/** Allocator events the flight recorder logs. */
+typedef enum
+{
+    /** mm_malloc handed out a block. */
+    FLIGHT_ALLOC,
+    /** mm_free was asked to free a block. */
+    FLIGHT_FREE,
+    /** split cut a block down to a size. */
+    FLIGHT_SPLIT,
+    /** coalesce was about to merge a free block with a free neighbour. */
+    FLIGHT_COALESCE,
+    /** requestMoreSpace grew the heap. */
+    FLIGHT_GROW
+} FlightOp;
+
+/** One event of the flight recorder. */
+typedef struct _FlightEvent
+{
+    /** Events the thread recorded before this one. */
+    uint64_t seq;
+    /** Header of the block, or start of the space the heap grew by. */
+    void *addr;
+    /** Bytes involved, negative if mm_free found the block already free. */
+    long size;
+    FlightOp op;
+} FlightEvent;
+
+/**
+ * Copies up to max of the calling thread's last events into events,
+ * oldest first, and returns how many, 0 when built with FLIGHT_RECORDER=0.
+ */
+int mm_flight_events(FlightEvent *events, int max);
+
+/**
+ * Writes the calling thread's last events to fd, oldest first. Uses only
+ * write, so a signal handler may call it; check_heap calls it when it
+ * finds corruption.
+ */
+void mm_flight_dump(int fd);
+
+/*********************************************/
+/*************** Heap Sampling ***************/
+/*********************************************/
+
+/** Most frames kept of the call stack of a sampled allocation. */
+#define HEAP_SAMPLE_DEPTH 16
+/** Most distinct call stacks a profile tells apart. */
+#define HEAP_SAMPLE_SITES 1024
+/** Most sampled blocks that can be live at once. */
+#define HEAP_SAMPLE_LIVE 4096
+
+/**
+ * What the sampled allocations from one call stack add up to. Each sample
+ * stands for all the allocations of its size it was drawn from, so the
+ * counts and bytes are estimates of every allocation, not only the sampled.
+ */
+typedef struct _HeapSite
+{
+    /** Return addresses, starting with mm_malloc's caller. */
+    void *stack[HEAP_SAMPLE_DEPTH];
+    /** Number of them, 0 for an unused site. */
+    int depth;
+    /** Allocations sampled here. */
+    uint64_t samples;
+    /** Estimated allocations and bytes made here since sampling started. */
+    double total_count;
+    double total_bytes;
+    /** Estimated allocations and bytes made here that are still live. */
+    double live_count;
+    double live_bytes;
+} HeapSite;
+
+/**
+ * Starts a new profile, sampling about one allocation in every interval
+ * bytes allocated. Intervals are drawn from an exponential distribution,
+ * so bytes are sampled as a Poisson process. An interval of 0 stops
+ * sampling. Blocks that shrink or grow in place keep the size they were
+ * sampled at.
+ */
+void mm_sample_heap(size_t interval);
+
+/** Copies up to max sites of the current profile into sites and returns how many. */
+int mm_heap_sites(HeapSite *sites, int max);
+
 /*********************************************/
 /*************** Backend Heap  ***************/
 /*********************************************/
@@ -189,10 +350,252 @@ int mm_init();
  */
 void *requestMoreSpace(size_t reqSize);
 
+/** Have the OS reclaim the last size bytes of the heap. */
+void releaseSpace(size_t size);
+
 /** Returns a pointer to the first block or returns NULL if there is not one. */
 Block *first_block();
 
 /**
  * Returns a pointer to the adjacent block or returns NULL if there is not one.
  */
-Block *next_block(Block *block);
\ No newline at end of file
+Block *next_block(Block *block);
+
+/*********************************************/
+/************ Garbage Collection *************/
+/*********************************************/
+
+/**
+ * Every block header starts on a multiple of this many bytes from
+ * mem_heap_lo(), so the collector keeps one bit per granule.
+ */
+#define GC_GRANULE_SIZE FREE_INFO_SIZE
+
+/** Number of granules in the largest heap memlib can hand out. */
+#define GC_NUM_GRANULES (MAX_HEAP / GC_GRANULE_SIZE)
+
+/**
+ * Words of marking work the malloc slow path performs for every word
+ * it allocates while an incremental collection is in progress.
+ */
+#define GC_WORK_RATIO 4
+
+/** Bytes of heap covered by one card of the old-to-young card table. */
+#define GC_CARD_SIZE 512
+
+/**
+ * Bytes of heap swept by one task of a parallel sweep. A multiple of 64
+ * granules, so no two tasks share a word of a granule bitmap.
+ */
+#define GC_SWEEP_SEGMENT (64 * 1024)
+#define GC_MAX_SWEEP_THREADS 64
+
+/**
+ * Typed requests larger than this fraction of the nursery skip it and
+ * are allocated in the old generation.
+ */
+#define GC_NURSERY_LARGE_FRACTION 8
+
+/** Collection percentage that turns the allocation trigger off. */
+#define GC_PERCENT_OFF -1
+
+/**
+ * Fewest bytes that must be allocated since the last collection before
+ * the allocator starts another one on its own.
+ */
+#define GC_MIN_TRIGGER (64 * 1024)
+
+/** Layout id of blocks whose every word may hold a pointer. */
+#define GC_LAYOUT_CONSERVATIVE 0
+
+/** Number of layouts the registry can hold, including the conservative one. */
+#define GC_MAX_LAYOUTS 256
+
+/** Largest element a layout can describe, in words. */
+#define GC_LAYOUT_MAX_WORDS 64
+
+/** Bit of a layout's pointer bitmap for a pointer field of a struct. */
+#define GC_POINTER_SLOT(type, field) ((uint64_t)1 << (offsetof(type, field) / WORD_SIZE))
+
+/**
+ * A Layout tells the collector which words of a payload hold pointers.
+ * Payloads larger than one element are treated as arrays of elements.
+ */
+typedef struct _Layout
+{
+    /** Size of one element in bytes, a multiple of the word size. */
+    size_t size;
+    /** Bit i is set when word i of an element holds a pointer. */
+    uint64_t pointers;
+} Layout;
+
+/** Current stage of the collection cycle. */
+typedef enum
+{
+    /** No collection cycle is in progress. */
+    GC_IDLE,
+    /** Grey blocks are waiting on the mark stack to be scanned. */
+    GC_MARKING,
+    /** Marking is done and unmarked blocks are freed as allocation misses. */
+    GC_SWEEPING
+} GCPhase;
+
+/**
+ * Frees every allocated block that is not reachable from the roots.
+ * Stops the world: marks and sweeps the whole heap before returning.
+ */
+extern void mm_garbage_collect(void **roots, size_t num_roots);
+
+/**
+ * Begins an incremental collection cycle by shading the given roots grey.
+ * The roots array must stay valid until the cycle finishes, because it is
+ * scanned again once the mark stack runs dry.
+ */
+extern void mm_gc_start(void **roots, size_t num_roots);
+
+/**
+ * Performs at most budget units of collection work, where a unit is a
+ * word scanned while marking or a block visited while sweeping.
+ * Returns 1 once the cycle has finished and the heap was swept, else 0.
+ */
+extern int mm_gc_step(size_t budget);
+
+/**
+ * Stores newval into the field of obj.
+ * While marking is in progress newval is shaded grey, so a black block
+ * never points at a white one (Dijkstra insertion barrier). A store of a
+ * young pointer into the old generation dirties the field's card.
+ */
+extern void mm_gc_write_barrier(void *obj, void **field, void *newval);
+
+/**
+ * Registers the address of a root variable.
+ * Registered roots are scanned by every collection and are the only
+ * roots mm_gc_compact updates when their block moves.
+ * The registry is cleared by mm_init.
+ */
+extern void mm_gc_register_root(void **slot);
+
+/** Stops treating the root variable at slot as a root. */
+extern void mm_gc_unregister_root(void **slot);
+
+/**
+ * Collects garbage from the registered roots and slides the live blocks
+ * toward mem_heap_lo(), giving the freed tail of the heap back.
+ * Pointer slots of typed blocks and registered roots are updated through
+ * forwarding addresses; a block referenced from an untyped block cannot
+ * have that reference updated, so it is pinned where it is, as is a block
+ * found by automatic root scanning. Pointers held anywhere else are left
+ * dangling, so compaction is opt-in.
+ */
+extern void mm_gc_compact();
+
+/**
+ * Registers the pointer layout of an element of the given size.
+ * Layouts outlive mm_init, so a program registers its types once.
+ * Returns the new layout id, or -1 if the registry is full or the
+ * element is empty or larger than GC_LAYOUT_MAX_WORDS words.
+ */
+extern int mm_gc_register_layout(size_t size, uint64_t pointers);
+
+/**
+ * Allocates a block like mm_malloc whose payload the collector scans
+ * precisely, visiting only the pointer slots of the given layout.
+ * Once a nursery is enabled, small typed blocks are bumped in it.
+ */
+extern void *mm_malloc_typed(size_t size, int layout_id);
+
+/**
+ * Carves a nursery of the given size out of the heap, from which
+ * mm_malloc_typed bumps young blocks. Young blocks may only be referenced
+ * from registered roots and from heap fields stored through
+ * mm_gc_write_barrier, because promotion moves them.
+ * Returns 0 on success, or -1 if a nursery exists or size is too small.
+ */
+extern int mm_gc_enable_nursery(size_t size);
+
+/**
+ * Promotes the young blocks reachable from the registered roots and the
+ * dirty cards into the free-list heap and empties the nursery.
+ * If a young block is referenced conservatively, the whole nursery is
+ * instead turned into old blocks in place and a new one is carved.
+ */
+extern void mm_gc_minor();
+
+/**
+ * Turns on automatic root scanning: every collection also scans the
+ * current thread's stack between base and the stack pointer, the
+ * callee-saved registers spilled by setjmp, and on Linux the program's
+ * .data and .bss. base is usually the address of a local in main;
+ * roots kept in main's own frame may lie beyond it.
+ * Passing NULL turns scanning off. Cleared by mm_init.
+ */
+extern void mm_gc_set_stack_base(void *base);
+
+/**
+ * Makes mm_malloc start an incremental cycle once the bytes allocated
+ * since the last cycle reach percent percent of the bytes that survived
+ * it, like GOGC. GC_PERCENT_OFF, the default, disables the trigger.
+ * Automatic cycles only see the registered and automatically scanned roots.
+ */
+extern void mm_gc_set_percent(int percent);
+
+/**
+ * Makes mm_malloc finish a collection before growing the heap past
+ * bytes, and grow it only if that did not free a fit. Zero, the
+ * default, disables the limit. The setting survives mm_init.
+ */
+extern void mm_gc_set_soft_limit(size_t bytes);
+
+/**
+ * Sweeps with up to threads threads whenever a sweep has to run to the
+ * end of the heap, as it does in mm_garbage_collect. One thread, the
+ * default, keeps the sweep serial. The setting survives mm_init.
+ */
+extern void mm_gc_set_sweep_threads(int threads);
+
+/** Returns how many sweeps so far were split among threads. */
+extern size_t mm_gc_parallel_sweeps();
+
+/**
+ * Returns the nanoseconds mm_malloc and mm_realloc spent collecting since
+ * mm_init: starting cycles, marking slices, lazy sweeping and collections
+ * forced by the soft limit.
+ */
+extern uint64_t mm_gc_assist_ns();
+
+/**
+ * Returns the allocated block whose payload contains ptr, or NULL if ptr
+ * does not point into an allocated payload.
+ */
+Block *gc_find_block(void *ptr);
+
+/**
+ * Returns the young block whose payload contains ptr, or NULL if ptr does
+ * not point into a young payload.
+ */
+Block *gc_find_young(void *ptr);
+
+/**
+ * Returns where ptr points once its young block is promoted, copying the
+ * block into the old generation the first time it is reached.
+ */
+void *gc_promote(void *ptr);
+
+/** Shades the block that ptr points into grey if it is still white. */
+void gc_shade(void *ptr);
+
+/**
+ * Shades the pointer slots of the block's payload, which are all of its
+ * words unless the block was allocated with a layout.
+ * Returns the number of words scanned.
+ */
+size_t gc_scan_block(Block *block);
+
+/**
+ * Resumes the lazy sweep, freeing unmarked blocks in address order.
+ * Stops after visiting budget blocks or as soon as a free block of at
+ * least reqSize bytes is produced, which is returned. A reqSize of zero
+ * never stops early. Returns NULL if no such block was produced.
+ */
+Block *gc_sweep(size_t reqSize, size_t budget);
@@ -0,0 +1,582 @@
+/*
+ * mmrecord.c - Record a program's malloc traffic as a .rep trace
+ *
+ * Build libmmrecord.so and preload it into the program to record:
+ *
+ *   LD_PRELOAD=./libmmrecord.so MMRECORD_OUT=app.rep ./app
+ *
+ * Every malloc, calloc, realloc and free is logged, with the calling
+ * thread's id and a timestamp, into a lock-free ring owned by that
+ * thread. A background thread drains the rings into a spool file, so
+ * the program only ever pays for a few stores per call. At exit the
+ * spool is put back into timestamp order, every block gets a stable id
+ * in allocation order, and the trace is written in the .rep format that
+ * mdriver reads (MMRECORD_OUT, mmrecord.rep by default).
+ *
+ * Every request ends in "@<thread> <ns>", numbering threads in the order
+ * they first allocate and timing requests from the first. A realloc of a
+ * recorded block keeps its id, and blocks still live at exit are freed
+ * at the end so the trace is balanced. Callocs are written as allocs.
+ * Blocks from other allocation functions, such as posix_memalign, are
+ * not recorded and their frees are dropped.
+ *
+ * A realloc logs the release of its old block before calling the real
+ * realloc, as free does, and the new block after. Another thread can be
+ * handed the old address as soon as the real realloc frees it, and its
+ * malloc must not be ordered ahead of the release.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define RING_EVENTS     65536   /* events a thread can log ahead of the flusher */
+#define FLUSH_INTERVAL  1000000 /* ns between two drains of the rings */
+#define BOOTSTRAP_SIZE  65536   /* bytes for dlsym's allocations during startup */
+#define DEFAULT_OUT     "mmrecord.rep"
+
+/******************************
+ * The key compound data types
+ *****************************/
+
+/* One logged call */
+typedef struct {
+    uint64_t time;  /* CLOCK_MONOTONIC ns */
+    uint64_t seq;   /* per-thread sequence number, breaks timestamp ties */
+    void *ptr;      /* block returned, or block freed */
+    void *old;      /* block a realloc was called on */
+    uint64_t size;  /* bytes requested */
+    int32_t tid;    /* calling thread */
+    /* A realloc logs EV_RELEASE for its old block, then EV_REALLOC */
+    enum {EV_ALLOC, EV_FREE, EV_RELEASE, EV_REALLOC} type;
+} event_t;
+
+/* A single-producer, single-consumer ring of one thread's events */
+typedef struct ring_t {
+    event_t *events;      /* RING_EVENTS slots, mapped outside of malloc */
+    uint64_t head;        /* next slot the thread writes */
+    uint64_t tail;        /* next slot the flusher reads */
+    uint64_t seq;         /* events the thread logged */
+    int32_t tid;
+    struct ring_t *next;  /* every thread's ring, pushed lock-free */
+} ring_t;
+
+/* A trace request, held until the header can be written */
+typedef struct {
+    char type;
+    int index;
+    uint64_t size;
+    int tid;        /* thread, numbered from 0 */
+    uint64_t time;  /* ns since the first request */
+} repop_t;
+
+/* Maps a live block to its id */
+typedef struct {
+    void *ptr;      /* NULL for an empty slot */
+    int index;
+    uint64_t size;
+} idslot_t;
+
+/********************
+ * Global variables
+ *******************/
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+/* Serves allocations that dlsym makes before the real malloc is known */
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrap_used = 0;
+static int resolving = 0;
+
+static int recording = 0;          /* log calls at all? */
+static ring_t *rings = NULL;       /* every thread's ring */
+static FILE *spool = NULL;         /* the drained events, in no particular order */
+static pthread_t flusher;
+static int flusher_running = 0;
+static int stop_flusher = 0;
+
+/* Set while the recorder itself allocates, so it does not record itself */
+static __thread int in_recorder = 0;
+static __thread ring_t *my_ring = NULL;
+
+/*********************
+ * Function prototypes
+ *********************/
+
+static void resolve(void);
+static void *bootstrap_alloc(size_t size);
+static int is_bootstrap(void *ptr);
+static void log_event(int type, void *ptr, void *old, size_t size);
+static ring_t *new_ring(void);
+static void drain(void);
+static void *flush_loop(void *arg);
+static void stop_in_child(void);
+static int cmp_event(const void *a, const void *b);
+static idslot_t *find_slot(idslot_t *slots, size_t capacity, void *ptr);
+static void write_trace(void);
+
+/***************************
+ * The interposed functions
+ ***************************/
+
+void *malloc(size_t size) {
+    void *p;
+
+    if (real_malloc == NULL) {
+        if (resolving)
+            return bootstrap_alloc(size);
+        resolve();
+    }
+
+    p = real_malloc(size);
+    if (recording && !in_recorder && p != NULL)
+        log_event(EV_ALLOC, p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    void *p;
+
+    if (real_calloc == NULL) {
+        if (resolving)
+            return bootstrap_alloc(nmemb * size); /* static, so already zeroed */
+        resolve();
+    }
+
+    p = real_calloc(nmemb, size);
+    if (recording && !in_recorder && p != NULL)
+        log_event(EV_ALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    void *p;
+
+    if (real_realloc == NULL) {
+        if (resolving)
+            return bootstrap_alloc(size);
+        resolve();
+    }
+
+    /* A bootstrap block cannot be handed to the real realloc */
+    if (is_bootstrap(ptr)) {
+        size_t old_size = ((size_t *)ptr)[-2];
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, ptr, (old_size < size) ? old_size : size);
+        return p;
+    }
+
+    /* The old block is released before it can be handed out again. A
+       failed realloc leaves it where it was, so it is taken back. */
+    if (recording && !in_recorder && ptr != NULL)
+        log_event(EV_RELEASE, NULL, ptr, 0);
+    p = real_realloc(ptr, size);
+    if (recording && !in_recorder)
+        log_event(EV_REALLOC, (p != NULL || size == 0) ? p : ptr, ptr, size);
+    return p;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || is_bootstrap(ptr))
+        return;
+    if (real_free == NULL)
+        resolve();
+
+    /* Logged before the block can be handed out again */
+    if (recording && !in_recorder)
+        log_event(EV_FREE, ptr, NULL, 0);
+    real_free(ptr);
+}
+
+/*******************************
+ * Startup and the event rings
+ *******************************/
+
+/*
+ * resolve - look up the functions being interposed. dlsym may allocate,
+ *     which the bootstrap buffer serves meanwhile.
+ */
+static void resolve(void) {
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    resolving = 0;
+
+    if (real_malloc == NULL || real_calloc == NULL ||
+        real_realloc == NULL || real_free == NULL) {
+        fprintf(stderr, "mmrecord: cannot find the real allocator\n");
+        _exit(1);
+    }
+}
+
+/*
+ * bootstrap_alloc - bump-allocate from the static buffer, keeping the
+ *     size in front of the block for realloc
+ */
+static void *bootstrap_alloc(size_t size) {
+    size_t need = 16 + ((size + 15) & ~(size_t)15);
+    char *p;
+
+    if (bootstrap_used + need > BOOTSTRAP_SIZE)
+        return NULL;
+    p = bootstrap + bootstrap_used + 16;
+    ((size_t *)p)[-2] = size;
+    bootstrap_used += need;
+    return p;
+}
+
+static int is_bootstrap(void *ptr) {
+    return (char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+/*
+ * log_event - append one event to the calling thread's ring. Blocks
+ *     while the ring is full, which only happens if the flusher falls
+ *     behind by a whole ring.
+ */
+static void log_event(int type, void *ptr, void *old, size_t size) {
+    ring_t *ring;
+    event_t *e;
+    struct timespec ts;
+    uint64_t head;
+
+    in_recorder = 1;
+    if ((ring = my_ring) == NULL && (ring = my_ring = new_ring()) == NULL) {
+        in_recorder = 0;
+        return;
+    }
+
+    head = ring->head;
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_EVENTS) {
+        if (!__atomic_load_n(&flusher_running, __ATOMIC_ACQUIRE)) {
+            in_recorder = 0;
+            return;
+        }
+        sched_yield();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    e = &ring->events[head % RING_EVENTS];
+    e->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    e->seq = ring->seq++;
+    e->ptr = ptr;
+    e->old = old;
+    e->size = size;
+    e->tid = ring->tid;
+    e->type = type;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    in_recorder = 0;
+}
+
+/*
+ * new_ring - map a ring for the calling thread and publish it to the flusher
+ */
+static ring_t *new_ring(void) {
+    ring_t *ring;
+    size_t bytes = sizeof(ring_t) + RING_EVENTS * sizeof(event_t);
+
+    ring = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return NULL;
+    ring->events = (event_t *)(ring + 1);
+    ring->head = ring->tail = ring->seq = 0;
+    ring->tid = syscall(SYS_gettid);
+
+    ring->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        ;
+    return ring;
+}
+
+/*
+ * drain - move every event the threads published into the spool
+ */
+static void drain(void) {
+    ring_t *ring;
+    uint64_t head, tail, end;
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (tail = ring->tail; tail < head; tail = end) {
+            end = head;
+            if (end / RING_EVENTS != tail / RING_EVENTS)
+                end = (tail / RING_EVENTS + 1) * RING_EVENTS; /* up to the wrap */
+            fwrite(&ring->events[tail % RING_EVENTS], sizeof(event_t), end - tail, spool);
+        }
+        __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * flush_loop - the background thread that keeps the rings from filling
+ */
+static void *flush_loop(void *arg) {
+    struct timespec interval = {0, FLUSH_INTERVAL};
+
+    in_recorder = 1;
+    while (!__atomic_load_n(&stop_flusher, __ATOMIC_ACQUIRE)) {
+        drain();
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+/*
+ * stop_in_child - a forked child has no flusher, so it is not recorded
+ */
+static void stop_in_child(void) {
+    recording = 0;
+    flusher_running = 0;
+}
+
+__attribute__((constructor))
+static void start_recording(void) {
+    in_recorder = 1;
+    if (real_malloc == NULL)
+        resolve();
+
+    if ((spool = tmpfile()) == NULL) {
+        fprintf(stderr, "mmrecord: cannot create the spool file\n");
+        in_recorder = 0;
+        return;
+    }
+    pthread_atfork(NULL, NULL, stop_in_child);
+
+    flusher_running = 1;
+    if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0) {
+        fprintf(stderr, "mmrecord: cannot start the flusher\n");
+        flusher_running = 0;
+        in_recorder = 0;
+        return;
+    }
+    recording = 1;
+    in_recorder = 0;
+}
+
+__attribute__((destructor))
+static void stop_recording(void) {
+    if (!recording)
+        return;
+
+    in_recorder = 1;
+    recording = 0;
+    __atomic_store_n(&stop_flusher, 1, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+    __atomic_store_n(&flusher_running, 0, __ATOMIC_RELEASE);
+    drain();
+
+    write_trace();
+    fclose(spool);
+}
+
+/**************************************
+ * Turning the spool into a .rep trace
+ **************************************/
+
+/*
+ * cmp_event - order events by time, then by thread and sequence number
+ */
+static int cmp_event(const void *a, const void *b) {
+    const event_t *x = (const event_t *)a;
+    const event_t *y = (const event_t *)b;
+
+    if (x->time != y->time)
+        return (x->time > y->time) - (x->time < y->time);
+    if (x->tid != y->tid)
+        return (x->tid > y->tid) - (x->tid < y->tid);
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/*
+ * find_slot - return the slot of ptr in the live-block table, or the
+ *     empty slot where it belongs
+ */
+static idslot_t *find_slot(idslot_t *slots, size_t capacity, void *ptr) {
+    size_t i = ((uintptr_t)ptr >> 4) * 2654435761u & (capacity - 1);
+
+    while (slots[i].ptr != NULL && slots[i].ptr != ptr)
+        i = (i + 1) & (capacity - 1);
+    return &slots[i];
+}
+
+/*
+ * remove_slot - delete a slot, shifting later entries of its probe chain back
+ */
+static void remove_slot(idslot_t *slots, size_t capacity, idslot_t *hole) {
+    size_t mask = capacity - 1;
+    size_t i = hole - slots;
+    size_t j = i;
+    size_t home;
+
+    for (;;) {
+        j = (j + 1) & mask;
+        if (slots[j].ptr == NULL)
+            break;
+        home = ((uintptr_t)slots[j].ptr >> 4) * 2654435761u & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].ptr = NULL;
+}
+
+/*
+ * write_trace - replay the sorted events against a table of live blocks,
+ *     assigning ids, and write the resulting requests as a .rep trace
+ */
+static void write_trace(void) {
+    event_t *events;
+    size_t num_events, i;
+    repop_t *ops;
+    size_t num_ops = 0;
+    idslot_t *slots;
+    idslot_t *slot;
+    size_t capacity;
+    int next_id = 0, num_tids = 0, tid;
+    int32_t *tids;
+    int *released;
+    uint64_t live_bytes = 0, peak_bytes = 0;
+    char *path;
+    FILE *out;
+
+    fflush(spool);
+    num_events = ftell(spool) / sizeof(event_t);
+    rewind(spool);
+    if ((events = malloc(num_events * sizeof(event_t) + 1)) == NULL ||
+        fread(events, sizeof(event_t), num_events, spool) != num_events) {
+        fprintf(stderr, "mmrecord: cannot read back the spool\n");
+        return;
+    }
+    qsort(events, num_events, sizeof(event_t), cmp_event);
+
+    /* Every event makes at most one request, and every block one more free */
+    for (capacity = 1024; capacity < 2 * num_events; capacity *= 2)
+        ;
+    ops = malloc(3 * num_events * sizeof(repop_t) + 1);
+    slots = calloc(capacity, sizeof(idslot_t));
+    tids = malloc(num_events * sizeof(int32_t) + 1);
+    released = malloc(num_events * sizeof(int) + 1);
+    if (ops == NULL || slots == NULL || tids == NULL || released == NULL) {
+        fprintf(stderr, "mmrecord: out of memory writing the trace\n");
+        return;
+    }
+
+    for (i = 0; i < num_events; i++) {
+        event_t *e = &events[i];
+        void *freed = (e->type == EV_REALLOC) ? NULL :
+                      (e->type == EV_FREE) ? e->ptr : e->old;
+        int old_index = -1;
+
+        /* Threads are few, so a linear search numbers them */
+        for (tid = 0; tid < num_tids && tids[tid] != e->tid; tid++)
+            ;
+        if (tid == num_tids) {
+            tids[num_tids++] = e->tid;
+            released[tid] = -1;
+        }
+        ops[num_ops].tid = ops[num_ops + 1].tid = tid;
+        ops[num_ops].time = ops[num_ops + 1].time = e->time - events[0].time;
+
+        /* Retire the block that was freed or reallocated away, unless it
+           was allocated before recording started. A realloc's old block
+           was retired by the release the same thread logged just before. */
+        if (e->type != EV_ALLOC && freed != NULL &&
+            (slot = find_slot(slots, capacity, freed))->ptr != NULL) {
+            old_index = slot->index;
+            live_bytes -= slot->size;
+            remove_slot(slots, capacity, slot);
+        }
+        if (e->type == EV_RELEASE) {
+            released[tid] = old_index;
+            continue;
+        }
+        if (e->type == EV_REALLOC) {
+            old_index = released[tid];
+            released[tid] = -1;
+        }
+
+        /* The new block, which a realloc may have left in place. It keeps
+           the id of the block it was reallocated from. */
+        if (e->type != EV_FREE && e->ptr != NULL) {
+            slot = find_slot(slots, capacity, e->ptr);
+
+            /* The address is still live if its free was never logged, as
+               when the program frees it through a path that is not
+               interposed. Retire the stale block so its id is not reused. */
+            if (slot->ptr != NULL) {
+                ops[num_ops].type = 'f';
+                ops[num_ops].index = slot->index;
+                ops[num_ops++].size = 0;
+                live_bytes -= slot->size;
+            }
+            slot->ptr = e->ptr;
+            slot->index = (old_index >= 0) ? old_index : next_id++;
+            slot->size = (e->size > 0) ? e->size : 1;
+            ops[num_ops].type = (old_index >= 0) ? 'r' : 'a';
+            ops[num_ops].index = slot->index;
+            ops[num_ops++].size = slot->size;
+            live_bytes += slot->size;
+            peak_bytes = (live_bytes > peak_bytes) ? live_bytes : peak_bytes;
+        }
+        else if (old_index >= 0) {
+            ops[num_ops].type = 'f';
+            ops[num_ops].index = old_index;
+            ops[num_ops++].size = 0;
+        }
+    }
+
+    /* Balance the trace by freeing whatever is still live */
+    for (i = 0; i < capacity; i++) {
+        if (slots[i].ptr != NULL) {
+            ops[num_ops].type = 'f';
+            ops[num_ops].index = slots[i].index;
+            ops[num_ops].tid = ops[num_ops - 1].tid;
+            ops[num_ops].time = ops[num_ops - 1].time;
+            ops[num_ops++].size = 0;
+        }
+    }
+
+    if ((path = getenv("MMRECORD_OUT")) == NULL)
+        path = DEFAULT_OUT;
+    if ((out = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "mmrecord: cannot open %s\n", path);
+        return;
+    }
+    fprintf(out, "%llu\n%d\n%zu\n1\n", (unsigned long long)peak_bytes, next_id, num_ops);
+    for (i = 0; i < num_ops; i++) {
+        if (ops[i].type == 'f')
+            fprintf(out, "f %d", ops[i].index);
+        else
+            fprintf(out, "%c %d %llu", ops[i].type, ops[i].index,
+                    (unsigned long long)ops[i].size);
+        fprintf(out, " @%d %llu\n", ops[i].tid, (unsigned long long)ops[i].time);
+    }
+    fclose(out);
+
+    free(events);
+    free(ops);
+    free(slots);
+    free(tids);
+    free(released);
+}
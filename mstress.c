@@ -0,0 +1,655 @@
+/*
+ * mstress.c - Multi-threaded allocator stress benchmarks
+ *
+ * Usage: mstress [-hl] [-b <bench>] [-t <threads>] [-s <scale>]
+ *
+ * Runs the classic multi-threaded allocator benchmarks against the mm
+ * package on 1, 2, 4... up to the given number of threads:
+ *
+ *   larson        server-style churn, where every block is freed by
+ *                 another thread than the one that allocated it
+ *   threadtest    independent per-thread rounds of allocs then frees
+ *   cache-thrash  each thread allocates, writes and frees one small
+ *                 object at a time, so objects that share a cache line
+ *                 across threads show up as lost throughput
+ *   cache-scratch like cache-thrash, but each thread starts by freeing
+ *                 an object the main thread allocated next to the others,
+ *                 which an allocator may then hand back to it
+ *   xmalloc       producers allocate blocks that consumers free
+ *
+ * mm is a single heap and is not thread-safe, so its calls are
+ * serialized with a mutex, and the benchmarks show what that costs. With
+ * -l they run against libc malloc as well, for comparison. Every run
+ * does the same total work, so the speedup is relative to one thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define MAX_THREADS    1024   /* most threads a benchmark may use */
+
+/* Work per run, times the -s scale, split among the threads */
+#define LARSON_SLOTS      4000   /* blocks live at once */
+#define LARSON_OPS        100000 /* frees and allocs of a round */
+#define LARSON_ROUNDS     4      /* times the slots change hands */
+#define LARSON_MIN        16     /* block sizes */
+#define LARSON_MAX        512
+#define THREADTEST_OBJS   50000  /* blocks allocated at once */
+#define THREADTEST_ITERS  20     /* rounds of allocating them all */
+#define THREADTEST_SIZE   64
+#define CACHE_OBJS        4000   /* objects allocated in turn */
+#define CACHE_WRITES      500    /* writes to every byte of each */
+#define CACHE_SIZE        8
+#define XMALLOC_BLOCKS    200000 /* blocks passed from producers to consumers */
+#define XMALLOC_BATCH     64     /* blocks passed at a time */
+#define XMALLOC_QUEUE     64     /* batches in flight at most */
+#define XMALLOC_MIN       16
+#define XMALLOC_MAX       256
+
+/******************************
+ * The key compound data types
+ *****************************/
+
+/* An allocator to stress */
+typedef struct {
+    char *name;
+    void (*reset)(void);          /* start from an empty heap */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    size_t (*heapsize)(void);     /* bytes of heap in use, or NULL */
+} allocator_t;
+
+/* A batch of blocks passed from an xmalloc producer to a consumer */
+typedef struct batch_t {
+    void *blocks[XMALLOC_BATCH];
+    struct batch_t *next;
+} batch_t;
+
+/* One thread of a benchmark */
+typedef struct {
+    int id;
+    int threads;              /* threads in the run */
+    allocator_t *alloc;
+    void **objs;              /* the blocks it holds between rounds */
+    int num_objs;
+    long count;               /* work it must do */
+    long ops;                 /* allocator calls it made */
+    uint64_t seed;
+    struct timespec start, end;
+    pthread_t thread;
+} worker_t;
+
+/* A benchmark, which returns the seconds it took and sets *ops to the
+   allocator calls it made */
+typedef struct {
+    char *name;
+    double (*run)(allocator_t *alloc, int threads, long *ops);
+} bench_t;
+
+/*********************
+ * Function prototypes
+ *********************/
+
+static double run_larson(allocator_t *alloc, int threads, long *ops);
+static double run_threadtest(allocator_t *alloc, int threads, long *ops);
+static double run_cache_thrash(allocator_t *alloc, int threads, long *ops);
+static double run_cache_scratch(allocator_t *alloc, int threads, long *ops);
+static double run_xmalloc(allocator_t *alloc, int threads, long *ops);
+static void *larson_worker(void *arg);
+static void *threadtest_worker(void *arg);
+static void *cache_worker(void *arg);
+static void *xmalloc_worker(void *arg);
+static void produce(worker_t *w);
+static void consume(worker_t *w);
+static double run_workers(worker_t *workers, int threads, void *(*fn)(void *));
+static void start_worker(worker_t *w);
+static void finish_worker(worker_t *w);
+static void thrash(char *obj);
+static size_t random_in(worker_t *w, size_t min, size_t max);
+static void mm_reset(void);
+static void *mm_locked_malloc(size_t size);
+static void mm_locked_free(void *ptr);
+static void libc_reset(void);
+static void usage(void);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+/********************
+ * Global variables
+ *******************/
+
+/* Multiplies the work of every benchmark (set by -s) */
+static double scale = 1;
+
+/* Releases the workers of a run all at once */
+static pthread_barrier_t start_line;
+
+/* mm is not thread-safe, so the workers take turns in it */
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The xmalloc queue of full batches, and the number of batches
+   producers may still fill */
+static batch_t *queue = NULL;
+static int queued = 0;
+static long batches_left = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_changed = PTHREAD_COND_INITIALIZER;
+
+static allocator_t allocators[] = {
+    {"mm", mm_reset, mm_locked_malloc, mm_locked_free, mem_heapsize},
+    {"libc", libc_reset, malloc, free, NULL},
+};
+
+static bench_t benches[] = {
+    {"larson", run_larson},
+    {"threadtest", run_threadtest},
+    {"cache-thrash", run_cache_thrash},
+    {"cache-scratch", run_cache_scratch},
+    {"xmalloc", run_xmalloc},
+};
+#define NUM_BENCHES (sizeof(benches) / sizeof(bench_t))
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv) {
+    char *only = NULL;      /* If set, run just this benchmark (-b) */
+    int max_threads = 8;    /* Most threads to run on (-t) */
+    int run_libc = 0;       /* If set, run libc malloc as well (-l) */
+    int b, a, threads, next, found = 0;
+    double secs, kops, base_kops = 0;
+    long ops;
+    char c;
+
+    while ((c = getopt(argc, argv, "hlb:t:s:")) != EOF) {
+        switch (c) {
+        case 'b': /* Run one benchmark only */
+            only = optarg;
+            break;
+        case 'l': /* Run libc malloc as well */
+            run_libc = 1;
+            break;
+        case 's': /* Scale the work of every benchmark */
+            if ((scale = atof(optarg)) <= 0)
+                app_error("The scale must be positive");
+            break;
+        case 't': /* Run on 1, 2, 4... up to this many threads */
+            max_threads = atoi(optarg);
+            if (max_threads < 1 || max_threads > MAX_THREADS)
+                app_error("The number of threads must be between 1 and 1024");
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    /* Initialize the simulated memory system in memlib.c */
+    mem_init();
+
+    printf("%-14s%-6s%8s%12s%10s%9s%10s\n",
+           "benchmark", "alloc", "threads", "ops", "secs", "Kops", "speedup");
+    for (b = 0; b < NUM_BENCHES; b++) {
+        if (only != NULL && strcmp(only, benches[b].name) != 0)
+            continue;
+        found = 1;
+        for (a = 0; a < (run_libc ? 2 : 1); a++) {
+            for (threads = 1; threads <= max_threads; threads = next) {
+                next = (threads < max_threads && 2 * threads > max_threads) ?
+                    max_threads : 2 * threads;
+                allocators[a].reset();
+                secs = benches[b].run(&allocators[a], threads, &ops);
+                kops = ops / 1e3 / secs;
+                if (threads == 1)
+                    base_kops = kops;
+                printf("%-14s%-6s%8d%12ld%10.6f%9.0f%8.2fx",
+                       benches[b].name, allocators[a].name, threads, ops, secs,
+                       kops, kops / base_kops);
+                if (allocators[a].heapsize != NULL)
+                    printf("  heap %zu KB", allocators[a].heapsize() / 1024);
+                printf("\n");
+            }
+        }
+    }
+
+    if (!found) {
+        fprintf(stderr, "No benchmark is called %s\n", only);
+        exit(1);
+    }
+    exit(0);
+}
+
+/*************************************************************
+ * The benchmarks. Each splits a fixed amount of work among its
+ * threads and times them from the first start to the last finish.
+ ************************************************************/
+
+/*
+ * run_larson - the main thread fills every worker's slots, and then in
+ *     every round each worker replaces random slots with new blocks.
+ *     Between rounds the slots move on to the next worker, so nearly
+ *     every block is freed by a thread other than its allocator.
+ */
+static double run_larson(allocator_t *alloc, int threads, long *ops) {
+    worker_t workers[MAX_THREADS];
+    void **held;
+    double secs = 0;
+    int t, i, round, slots = LARSON_SLOTS / threads;
+
+    for (t = 0; t < threads; t++) {
+        workers[t].alloc = alloc;
+        workers[t].seed = t + 1;
+        workers[t].num_objs = (slots > 0) ? slots : 1;
+        workers[t].count = (long)(scale * LARSON_OPS / threads);
+        if ((workers[t].objs = malloc(workers[t].num_objs * sizeof(void *))) == NULL)
+            unix_error("malloc failed in run_larson");
+        for (i = 0; i < workers[t].num_objs; i++)
+            if ((workers[t].objs[i] =
+                 alloc->malloc(random_in(&workers[t], LARSON_MIN, LARSON_MAX))) == NULL)
+                app_error("The allocator failed in run_larson");
+    }
+
+    *ops = 0;
+    for (round = 0; round < LARSON_ROUNDS; round++) {
+        secs += run_workers(workers, threads, larson_worker);
+        for (t = 0; t < threads; t++)
+            *ops += workers[t].ops;
+        held = workers[threads - 1].objs;
+        for (t = threads - 1; t > 0; t--)
+            workers[t].objs = workers[t - 1].objs;
+        workers[0].objs = held;
+    }
+    for (t = 0; t < threads; t++) {
+        for (i = 0; i < workers[t].num_objs; i++)
+            alloc->free(workers[t].objs[i]);
+        free(workers[t].objs);
+    }
+    return secs;
+}
+
+static void *larson_worker(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    long i;
+    int slot;
+
+    start_worker(w);
+    for (i = 0; i < w->count; i++) {
+        slot = random_in(w, 0, w->num_objs - 1);
+        w->alloc->free(w->objs[slot]);
+        if ((w->objs[slot] = w->alloc->malloc(random_in(w, LARSON_MIN, LARSON_MAX))) == NULL)
+            app_error("The allocator failed in larson_worker");
+    }
+    w->ops += 2 * w->count;
+    finish_worker(w);
+    return NULL;
+}
+
+/*
+ * run_threadtest - every worker repeatedly allocates its share of the
+ *     objects and then frees them all, touching no one else's
+ */
+static double run_threadtest(allocator_t *alloc, int threads, long *ops) {
+    worker_t workers[MAX_THREADS];
+    double secs;
+    int t;
+
+    for (t = 0; t < threads; t++) {
+        workers[t].alloc = alloc;
+        workers[t].num_objs = THREADTEST_OBJS / threads;
+        workers[t].count = (long)(scale * THREADTEST_ITERS);
+        if ((workers[t].objs = malloc((workers[t].num_objs + 1) * sizeof(void *))) == NULL)
+            unix_error("malloc failed in run_threadtest");
+    }
+
+    secs = run_workers(workers, threads, threadtest_worker);
+    for (*ops = 0, t = 0; t < threads; t++) {
+        *ops += workers[t].ops;
+        free(workers[t].objs);
+    }
+    return secs;
+}
+
+static void *threadtest_worker(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    long iter;
+    int i;
+
+    start_worker(w);
+    for (iter = 0; iter < w->count; iter++) {
+        for (i = 0; i < w->num_objs; i++)
+            if ((w->objs[i] = w->alloc->malloc(THREADTEST_SIZE)) == NULL)
+                app_error("The allocator failed in threadtest_worker");
+        for (i = 0; i < w->num_objs; i++)
+            w->alloc->free(w->objs[i]);
+    }
+    w->ops += 2 * w->count * w->num_objs;
+    finish_worker(w);
+    return NULL;
+}
+
+/*
+ * run_cache_thrash - every worker allocates, writes and frees one small
+ *     object at a time
+ */
+static double run_cache_thrash(allocator_t *alloc, int threads, long *ops) {
+    worker_t workers[MAX_THREADS];
+    double secs;
+    int t;
+
+    for (t = 0; t < threads; t++) {
+        workers[t].alloc = alloc;
+        workers[t].objs = NULL;
+        workers[t].num_objs = 0;
+        workers[t].count = (long)(scale * CACHE_OBJS / threads);
+    }
+
+    secs = run_workers(workers, threads, cache_worker);
+    for (*ops = 0, t = 0; t < threads; t++)
+        *ops += workers[t].ops;
+    return secs;
+}
+
+/*
+ * run_cache_scratch - like cache-thrash, but the main thread first
+ *     allocates an object for every worker, one after the other, and
+ *     each worker starts by freeing its own. An allocator that hands
+ *     those back out puts objects of different threads on one line.
+ */
+static double run_cache_scratch(allocator_t *alloc, int threads, long *ops) {
+    worker_t workers[MAX_THREADS];
+    void *objs[MAX_THREADS];
+    double secs;
+    int t;
+
+    for (t = 0; t < threads; t++) {
+        if ((objs[t] = alloc->malloc(CACHE_SIZE)) == NULL)
+            app_error("The allocator failed in run_cache_scratch");
+        workers[t].alloc = alloc;
+        workers[t].objs = &objs[t];
+        workers[t].num_objs = 1;
+        workers[t].count = (long)(scale * CACHE_OBJS / threads);
+    }
+
+    secs = run_workers(workers, threads, cache_worker);
+    for (*ops = 0, t = 0; t < threads; t++)
+        *ops += workers[t].ops;
+    return secs;
+}
+
+static void *cache_worker(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    char *obj;
+    long i;
+
+    start_worker(w);
+    if (w->num_objs > 0) {
+        thrash(w->objs[0]);
+        w->alloc->free(w->objs[0]);
+        w->ops++;
+    }
+    for (i = 0; i < w->count; i++) {
+        if ((obj = w->alloc->malloc(CACHE_SIZE)) == NULL)
+            app_error("The allocator failed in cache_worker");
+        thrash(obj);
+        w->alloc->free(obj);
+    }
+    w->ops += 2 * w->count;
+    finish_worker(w);
+    return NULL;
+}
+
+/*
+ * thrash - write every byte of an object many times. The writes run
+ *     outside of mm_lock, so only the object's placement slows them.
+ */
+static void thrash(char *obj) {
+    volatile char *p = obj;
+    int i, j;
+
+    for (i = 0; i < CACHE_WRITES; i++)
+        for (j = 0; j < CACHE_SIZE; j++)
+            p[j]++;
+}
+
+/*
+ * run_xmalloc - threads producers allocate batches of blocks, and as
+ *     many consumers free them
+ */
+static double run_xmalloc(allocator_t *alloc, int threads, long *ops) {
+    worker_t workers[2 * MAX_THREADS];
+    double secs;
+    int t;
+
+    queue = NULL;
+    queued = 0;
+    batches_left = (long)(scale * XMALLOC_BLOCKS / XMALLOC_BATCH);
+    for (t = 0; t < 2 * threads; t++) {
+        workers[t].alloc = alloc;
+        workers[t].seed = t + 1;
+    }
+
+    secs = run_workers(workers, 2 * threads, xmalloc_worker);
+    for (*ops = 0, t = 0; t < 2 * threads; t++)
+        *ops += workers[t].ops;
+    return secs;
+}
+
+/*
+ * xmalloc_worker - the first half of the workers produce, the rest consume
+ */
+static void *xmalloc_worker(void *arg) {
+    worker_t *w = (worker_t *)arg;
+
+    start_worker(w);
+    if (w->id < w->threads / 2)
+        produce(w);
+    else
+        consume(w);
+    finish_worker(w);
+    return NULL;
+}
+
+static void produce(worker_t *w) {
+    batch_t *batch;
+    int i;
+
+    for (;;) {
+        /* Claim a batch to fill, once there is room in the queue */
+        pthread_mutex_lock(&queue_lock);
+        while (batches_left > 0 && queued >= XMALLOC_QUEUE)
+            pthread_cond_wait(&queue_changed, &queue_lock);
+        if (batches_left == 0) {
+            pthread_mutex_unlock(&queue_lock);
+            return;
+        }
+        batches_left--;
+        queued++;
+        pthread_mutex_unlock(&queue_lock);
+
+        if ((batch = malloc(sizeof(batch_t))) == NULL)
+            unix_error("malloc failed in produce");
+        for (i = 0; i < XMALLOC_BATCH; i++)
+            if ((batch->blocks[i] =
+                 w->alloc->malloc(random_in(w, XMALLOC_MIN, XMALLOC_MAX))) == NULL)
+                app_error("The allocator failed in produce");
+        w->ops += XMALLOC_BATCH;
+
+        pthread_mutex_lock(&queue_lock);
+        batch->next = queue;
+        queue = batch;
+        pthread_cond_broadcast(&queue_changed);
+        pthread_mutex_unlock(&queue_lock);
+    }
+}
+
+static void consume(worker_t *w) {
+    batch_t *batch;
+    int i;
+
+    for (;;) {
+        /* Wait while batches are still to come, or being freed by
+           another consumer, which may be the last of them */
+        pthread_mutex_lock(&queue_lock);
+        while (queue == NULL && (queued > 0 || batches_left > 0))
+            pthread_cond_wait(&queue_changed, &queue_lock);
+        if (queue == NULL) {
+            pthread_mutex_unlock(&queue_lock);
+            return;
+        }
+        batch = queue;
+        queue = batch->next;
+        pthread_mutex_unlock(&queue_lock);
+
+        for (i = 0; i < XMALLOC_BATCH; i++)
+            w->alloc->free(batch->blocks[i]);
+        w->ops += XMALLOC_BATCH;
+        free(batch);
+
+        pthread_mutex_lock(&queue_lock);
+        queued--;
+        pthread_cond_broadcast(&queue_changed);
+        pthread_mutex_unlock(&queue_lock);
+    }
+}
+
+/*******************************************************
+ * Helpers shared by the benchmarks and the allocators
+ ******************************************************/
+
+/*
+ * run_workers - run fn on threads workers released all at once, and
+ *     return the seconds from the first start to the last finish
+ */
+static double run_workers(worker_t *workers, int threads, void *(*fn)(void *)) {
+    struct timespec first, last;
+    int t;
+
+    if (pthread_barrier_init(&start_line, NULL, threads) != 0)
+        unix_error("pthread_barrier_init failed in run_workers");
+    for (t = 0; t < threads; t++) {
+        workers[t].id = t;
+        workers[t].threads = threads;
+        workers[t].ops = 0;
+        if (pthread_create(&workers[t].thread, NULL, fn, &workers[t]) != 0)
+            unix_error("pthread_create failed in run_workers");
+    }
+
+    for (t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        if (t == 0 || workers[t].start.tv_sec < first.tv_sec ||
+            (workers[t].start.tv_sec == first.tv_sec && workers[t].start.tv_nsec < first.tv_nsec))
+            first = workers[t].start;
+        if (t == 0 || workers[t].end.tv_sec > last.tv_sec ||
+            (workers[t].end.tv_sec == last.tv_sec && workers[t].end.tv_nsec > last.tv_nsec))
+            last = workers[t].end;
+    }
+    pthread_barrier_destroy(&start_line);
+
+    return (last.tv_sec - first.tv_sec) + (last.tv_nsec - first.tv_nsec) / 1e9;
+}
+
+/*
+ * start_worker - wait for the rest of the run's workers, then note the time
+ */
+static void start_worker(worker_t *w) {
+    pthread_barrier_wait(&start_line);
+    clock_gettime(CLOCK_MONOTONIC, &w->start);
+}
+
+/*
+ * finish_worker - note the time a worker finished its work
+ */
+static void finish_worker(worker_t *w) {
+    clock_gettime(CLOCK_MONOTONIC, &w->end);
+}
+
+/*
+ * random_in - a number in [min, max] from the worker's own
+ *     xorshift64* generator, so the workers share no state
+ */
+static size_t random_in(worker_t *w, size_t min, size_t max) {
+    w->seed ^= w->seed >> 12;
+    w->seed ^= w->seed << 25;
+    w->seed ^= w->seed >> 27;
+    return min + (w->seed * 2685821657736338717ULL >> 11) % (max - min + 1);
+}
+
+/*
+ * mm_reset - start the mm package over on an empty heap
+ */
+static void mm_reset(void) {
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed");
+}
+
+static void *mm_locked_malloc(size_t size) {
+    void *p;
+
+    pthread_mutex_lock(&mm_lock);
+    p = mm_malloc(size);
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+static void mm_locked_free(void *ptr) {
+    pthread_mutex_lock(&mm_lock);
+    mm_free(ptr);
+    pthread_mutex_unlock(&mm_lock);
+}
+
+/*
+ * libc_reset - libc's heap needs no reset between runs
+ */
+static void libc_reset(void) {
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void) {
+    int b;
+
+    fprintf(stderr, "Usage: mstress [-hl] [-b <bench>] [-t <threads>] [-s <scale>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <bench>    Run only this benchmark:");
+    for (b = 0; b < NUM_BENCHES; b++)
+        fprintf(stderr, " %s", benches[b].name);
+    fprintf(stderr, ".\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-l            Run libc malloc as well.\n");
+    fprintf(stderr, "\t-s <scale>    Multiply the work of every benchmark (1).\n");
+    fprintf(stderr, "\t-t <threads>  Run on 1, 2, 4... up to this many threads (8).\n");
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg) {
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
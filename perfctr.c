@@ -0,0 +1,111 @@
+/*
+ * perfctr.c - Hardware performance counters through perf_event_open
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* The event type and config of every counter */
+static struct {
+    uint32_t type;
+    uint64_t config;
+} events[NUM_PERFCTRS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+#endif
+
+char *perfctr_names[NUM_PERFCTRS] = {
+    "cycles", "instrs", "L1D", "LLC", "dTLB", "brmiss"
+};
+
+int perfctr_open(perfctr_t *ctrs) {
+    int i, num_open = 0;
+
+    for (i = 0; i < NUM_PERFCTRS; i++)
+        ctrs->fds[i] = -1;
+
+#ifdef __linux__
+    for (i = 0; i < NUM_PERFCTRS; i++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;  /* allowed at perf_event_paranoid 2 */
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        ctrs->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (ctrs->fds[i] >= 0)
+            num_open++;
+    }
+#else
+    errno = ENOSYS;
+#endif
+    return num_open;
+}
+
+void perfctr_start(perfctr_t *ctrs) {
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < NUM_PERFCTRS; i++) {
+        if (ctrs->fds[i] >= 0) {
+            ioctl(ctrs->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(ctrs->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+void perfctr_stop(perfctr_t *ctrs, double values[NUM_PERFCTRS]) {
+    int i;
+
+    for (i = 0; i < NUM_PERFCTRS; i++)
+        values[i] = -1;
+
+#ifdef __linux__
+    for (i = 0; i < NUM_PERFCTRS; i++)
+        if (ctrs->fds[i] >= 0)
+            ioctl(ctrs->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < NUM_PERFCTRS; i++) {
+        uint64_t count[3]; /* value, time enabled, time running */
+
+        if (ctrs->fds[i] < 0 || read(ctrs->fds[i], count, sizeof(count)) != sizeof(count))
+            continue;
+        if (count[2] == 0)
+            continue; /* never got onto the PMU */
+        if (count[2] < count[1])
+            values[i] = (double)count[0] * count[1] / count[2];
+        else
+            values[i] = (double)count[0];
+    }
+#endif
+}
+
+void perfctr_close(perfctr_t *ctrs) {
+    int i;
+
+    for (i = 0; i < NUM_PERFCTRS; i++) {
+        if (ctrs->fds[i] >= 0)
+            close(ctrs->fds[i]);
+        ctrs->fds[i] = -1;
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * perfctr.h - Hardware performance counters through perf_event_open
+ *
+ * Each counter is opened on its own, for the calling thread and in user
+ * mode only, so whatever counters the kernel and CPU allow still count
+ * when others are missing or unprivileged. Counts are scaled up when
+ * the kernel had to multiplex the counters.
+ */
+#include <stdint.h>
+
+enum {
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_L1D_MISSES,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_DTLB_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    NUM_PERFCTRS
+};
+
+/* Short column names for the counters, in the order above */
+extern char *perfctr_names[NUM_PERFCTRS];
+
+typedef struct {
+    int fds[NUM_PERFCTRS];   /* -1 for a counter that is unavailable */
+} perfctr_t;
+
+/* Open every counter that is available. Returns how many are, and
+   leaves the reason the last one failed in errno. */
+int perfctr_open(perfctr_t *ctrs);
+
+/* Zero the open counters and start them */
+void perfctr_start(perfctr_t *ctrs);
+
+/* Stop the counters and store their counts in values, or -1 for the
+   counters that are unavailable */
+void perfctr_stop(perfctr_t *ctrs, double values[NUM_PERFCTRS]);
+
+/* Close every open counter */
+void perfctr_close(perfctr_t *ctrs);
@@ -0,0 +1,78 @@
+/*
+ * rep2bin.c - Convert a text .rep trace into the binary trace format
+ *
+ * Usage: rep2bin <in.rep> <out.bin>
+ *
+ * mdriver recognizes binary traces by their magic number and maps them
+ * instead of parsing them, which pays off for traces of many millions
+ * of requests.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tracebin.h"
+
+#define MAXLINE 1024 /* max string size */
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg) {
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    FILE *in, *out;
+    tracebin_header_t header;
+    tracebin_op_t op;
+    char line[MAXLINE];
+    int num_ops = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <in.rep> <out.bin>\n", argv[0]);
+        exit(1);
+    }
+
+    if ((in = fopen(argv[1], "r")) == NULL)
+        unix_error("Could not open the input trace");
+    if ((out = fopen(argv[2], "wb")) == NULL)
+        unix_error("Could not open the output trace");
+
+    memcpy(header.magic, TRACEBIN_MAGIC, TRACEBIN_MAGIC_SIZE);
+    if (fscanf(in, "%d %d %d %d", &header.sugg_heapsize, &header.num_ids,
+               &header.num_ops, &header.weight) != 4) {
+        printf("Malformed header in %s\n", argv[1]);
+        exit(1);
+    }
+    if (fwrite(&header, sizeof(header), 1, out) != 1)
+        unix_error("Could not write the header");
+
+    /* Translate every request line into a record */
+    while (fgets(line, MAXLINE, in) != NULL) {
+        switch (tracebin_parse(line, &op)) {
+        case 0:
+            continue;
+        case -1:
+            printf("Malformed request (%s) in tracefile %s\n",
+                   strtok(line, "\n"), argv[1]);
+            exit(1);
+        }
+        if (fwrite(&op, sizeof(op), 1, out) != 1)
+            unix_error("Could not write a request");
+        num_ops++;
+    }
+
+    if (num_ops != header.num_ops) {
+        printf("%s declares %d requests but holds %d\n",
+               argv[1], header.num_ops, num_ops);
+        exit(1);
+    }
+
+    fclose(in);
+    if (fclose(out) != 0)
+        unix_error("Could not close the output trace");
+    return 0;
+}
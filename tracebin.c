@@ -0,0 +1,74 @@
+/*
+ * tracebin.c - Parse the request lines of text traces into records
+ */
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include "tracebin.h"
+
+int tracebin_parse(char *line, tracebin_op_t *op) {
+    char type;
+    int elem_size, fields;
+    long long time;
+    char *at;
+
+    memset(op, 0, sizeof(tracebin_op_t));
+    if (sscanf(line, " %c", &type) != 1)
+        return 0;
+
+    switch (type) {
+    case 'a':
+        op->type = TRACEBIN_ALLOC;
+        fields = sscanf(line, " a %d %d", &op->index, &op->size) == 2;
+        break;
+    case 'f':
+        op->type = TRACEBIN_FREE;
+        fields = sscanf(line, " f %d", &op->index) == 1;
+        break;
+    case 'r':
+        op->type = TRACEBIN_REALLOC;
+        fields = sscanf(line, " r %d %d", &op->index, &op->size) == 2;
+        break;
+    case 'c':
+        /* The record keeps the total, which is what gets allocated */
+        op->type = TRACEBIN_CALLOC;
+        fields = sscanf(line, " c %d %d %d", &op->index, &op->arg, &elem_size) == 3 &&
+            op->arg > 0 && elem_size > 0 && elem_size <= INT_MAX / op->arg;
+        if (fields)
+            op->size = op->arg * elem_size;
+        break;
+    case 'm':
+        op->type = TRACEBIN_MEMALIGN;
+        fields = sscanf(line, " m %d %d %d", &op->index, &op->arg, &op->size) == 3;
+        break;
+    case 's':
+        op->type = TRACEBIN_SIZED_FREE;
+        fields = sscanf(line, " s %d %d", &op->index, &op->size) == 2;
+        break;
+    default:
+        return -1;
+    }
+    if (!fields || !tracebin_valid(op))
+        return -1;
+
+    /* The optional thread and timestamp */
+    if ((at = strchr(line, '@')) != NULL) {
+        if (sscanf(at, "@%d %lld", &op->tid, &time) != 2)
+            return -1;
+        op->time = time;
+    }
+    return 1;
+}
+
+int tracebin_valid(tracebin_op_t *op) {
+    if (op->type < TRACEBIN_ALLOC || op->type > TRACEBIN_SIZED_FREE ||
+        op->index < 0 || op->size < 0)
+        return 0;
+
+    /* The replay divides a calloc's total by its count */
+    if (op->type == TRACEBIN_CALLOC)
+        return op->arg > 0 && op->size % op->arg == 0;
+    if (op->type == TRACEBIN_MEMALIGN)
+        return op->arg > 0 && (op->arg & (op->arg - 1)) == 0;
+    return 1;
+}
@@ -0,0 +1,59 @@
+/*
+ * Binary trace format
+ *
+ * A binary trace is a tracebin_header_t followed by num_ops
+ * tracebin_op_t records, all in the host's byte order. The records have
+ * the layout of mdriver's traceop_t, so a mapped file is replayed in
+ * place without parsing.
+ *
+ * The request lines of a text trace map onto the same records:
+ *
+ *   a <id> <size>               malloc
+ *   f <id>                      free
+ *   r <id> <size>               realloc, keeping the id
+ *   c <id> <count> <size>       calloc of count elements of size bytes
+ *   m <id> <alignment> <size>   memalign
+ *   s <id> <size>               free of a block known to be size bytes
+ *
+ * Any line may end in "@<tid> <ns>", the thread that made the request
+ * and when.
+ */
+#include <stdint.h>
+
+#define TRACEBIN_MAGIC "MMTRACE2"
+#define TRACEBIN_MAGIC_SIZE 8
+
+/* Request types, numbered like traceop_t's */
+#define TRACEBIN_ALLOC      0
+#define TRACEBIN_FREE       1
+#define TRACEBIN_REALLOC    2
+#define TRACEBIN_CALLOC     3
+#define TRACEBIN_MEMALIGN   4
+#define TRACEBIN_SIZED_FREE 5
+
+typedef struct {
+    char magic[TRACEBIN_MAGIC_SIZE]; /* TRACEBIN_MAGIC, not NUL-terminated */
+    int32_t sugg_heapsize;           /* the four header lines of a .rep */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t weight;
+} tracebin_header_t;
+
+typedef struct {
+    int32_t type;  /* one of the TRACEBIN_ request types */
+    int32_t index; /* block id */
+    int32_t size;  /* bytes requested, in total for a calloc */
+    int32_t arg;   /* calloc's element count or memalign's alignment */
+    int32_t tid;   /* thread that made the request, 0 if not recorded */
+    int32_t pad;   /* keeps time 8-byte aligned */
+    int64_t time;  /* when it was made in ns, 0 if not recorded */
+} tracebin_op_t;
+
+/* Parse one request line of a text trace into op. Returns 1 for a
+   request, 0 for a blank line and -1 for a malformed line. */
+int tracebin_parse(char *line, tracebin_op_t *op);
+
+/* Returns 1 if op is a request a text trace could have held, so that a
+   binary record can be replayed as safely as a parsed line. Its id is
+   only checked to be non-negative. */
+int tracebin_valid(tracebin_op_t *op);
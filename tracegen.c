@@ -0,0 +1,382 @@
+/*
+ * tracegen.c - Generate .rep traces from size and lifetime distributions
+ *
+ * Usage: tracegen [-h] [-n <n>] [-s <sizes>] [-l <lifetimes>]
+ *                 [-L <bytes>] [-r <frac>] [-S <seed>] [-o <file>]
+ *
+ * The generated trace makes n allocation or realloc requests. Before
+ * each one, blocks are freed while the live payload is at or above the
+ * live-set target, in the order the lifetime policy gives. Under the
+ * exponential policy every block also dies on its own once its drawn
+ * lifetime, counted in requests, has passed. Blocks still live at the
+ * end are freed, so the trace is balanced.
+ *
+ * Realloc requests use the 'r' type, which keeps the block's id.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <getopt.h>
+
+#define MAXLINE 1024 /* max string size */
+
+/******************************
+ * The key compound data types
+ *****************************/
+
+/* A size distribution, parsed from -s */
+typedef struct {
+    enum {SIZE_POWER, SIZE_BIMODAL, SIZE_HIST} kind;
+    double alpha;           /* power: tail exponent */
+    double min, max;        /* power: bounds; bimodal: the two modes */
+    double p_large;         /* bimodal: chance of the large mode */
+    int num_bins;           /* hist: the empirical histogram */
+    int *bin_size;
+    double *bin_cdf;
+} sizedist_t;
+
+/* The order blocks die in, parsed from -l */
+typedef struct {
+    enum {LIFE_EXP, LIFE_LIFO, LIFE_FIFO} kind;
+    double mean;            /* exp: mean lifetime in requests */
+} lifedist_t;
+
+/* A live block. The live set is a min-heap on death. */
+typedef struct {
+    double death;           /* smaller dies first */
+    int index;
+    int size;
+} live_t;
+
+/* A trace request, held until the header can be written */
+typedef struct {
+    char type;
+    int index;
+    int size;
+} genop_t;
+
+/********************
+ * Global variables
+ *******************/
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static live_t *live;        /* the live set */
+static int num_live = 0;
+static genop_t *ops;
+static int num_ops = 0;
+
+/*********************
+ * Function prototypes
+ *********************/
+
+static double uniform(void);
+static int draw_size(sizedist_t *sizes);
+static void parse_sizes(char *spec, sizedist_t *sizes);
+static void parse_lifetimes(char *spec, lifedist_t *lifetimes);
+static void push_live(live_t block);
+static live_t pop_live(void);
+static void emit(char type, int index, int size);
+static void usage(void);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv) {
+    sizedist_t sizes = {SIZE_POWER, 1.5, 16, 4096};
+    lifedist_t lifetimes = {LIFE_EXP, 100};
+    int num_requests = 10000;
+    long live_target = 1 << 20;
+    double realloc_frac = 0;
+    char *outfile = NULL;
+    FILE *out = stdout;
+    long live_bytes = 0, peak_bytes = 0;
+    int next_id = 0;
+    int i;
+    char c;
+
+    while ((c = getopt(argc, argv, "hn:s:l:L:r:S:o:")) != EOF) {
+        switch (c) {
+        case 'n': /* Number of allocation and realloc requests */
+            num_requests = atoi(optarg);
+            break;
+        case 's': /* Size distribution */
+            parse_sizes(optarg, &sizes);
+            break;
+        case 'l': /* Lifetime distribution */
+            parse_lifetimes(optarg, &lifetimes);
+            break;
+        case 'L': /* Live-set target in bytes */
+            live_target = atol(optarg);
+            break;
+        case 'r': /* Fraction of requests that are reallocs */
+            realloc_frac = atof(optarg);
+            break;
+        case 'S': /* Random seed, so traces are reproducible */
+            rng_state = strtoull(optarg, NULL, 0) * 2685821657736338717ULL + 1;
+            break;
+        case 'o': /* Output file, stdout by default */
+            outfile = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (num_requests <= 0 || live_target <= 0 || realloc_frac < 0 || realloc_frac > 1)
+        app_error("The request count and live-set target must be positive, "
+                  "and the realloc fraction within [0, 1]");
+
+    if ((live = malloc(num_requests * sizeof(live_t))) == NULL ||
+        (ops = malloc(2 * num_requests * sizeof(genop_t))) == NULL)
+        app_error("Out of memory");
+
+    for (i = 0; i < num_requests; i++) {
+        live_t block;
+
+        /* Free whatever has died, and whatever is over the target */
+        while (num_live > 0 &&
+               ((lifetimes.kind == LIFE_EXP && live[0].death <= i) ||
+                live_bytes >= live_target)) {
+            block = pop_live();
+            emit('f', block.index, 0);
+            live_bytes -= block.size;
+        }
+
+        /* Resize a random live block in place in the live set */
+        if (num_live > 0 && uniform() < realloc_frac) {
+            live_t *victim = &live[(int)(uniform() * num_live)];
+            int size = draw_size(&sizes);
+            emit('r', victim->index, size);
+            live_bytes += size - victim->size;
+            victim->size = size;
+        }
+        else {
+            block.index = next_id++;
+            block.size = draw_size(&sizes);
+            switch (lifetimes.kind) {
+            case LIFE_EXP:
+                block.death = i + 1 - lifetimes.mean * log(1 - uniform());
+                break;
+            case LIFE_LIFO:
+                block.death = -i;
+                break;
+            case LIFE_FIFO:
+                block.death = i;
+                break;
+            }
+            push_live(block);
+            emit('a', block.index, block.size);
+            live_bytes += block.size;
+        }
+        if (live_bytes > peak_bytes)
+            peak_bytes = live_bytes;
+    }
+
+    /* Balance the trace */
+    while (num_live > 0)
+        emit('f', pop_live().index, 0);
+
+    if (outfile != NULL && (out = fopen(outfile, "w")) == NULL)
+        unix_error("Could not open the output trace");
+    fprintf(out, "%ld\n%d\n%d\n1\n", peak_bytes, next_id, num_ops);
+    for (i = 0; i < num_ops; i++) {
+        if (ops[i].type == 'f')
+            fprintf(out, "f %d\n", ops[i].index);
+        else
+            fprintf(out, "%c %d %d\n", ops[i].type, ops[i].index, ops[i].size);
+    }
+    if (out != stdout)
+        fclose(out);
+
+    free(live);
+    free(ops);
+    exit(0);
+}
+
+/*****************
+ * Distributions
+ *****************/
+
+/*
+ * uniform - a double in [0, 1) from xorshift64*, which gives the same
+ *     trace for the same seed on every platform
+ */
+static double uniform(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * draw_size - draw one request size from the size distribution
+ */
+static int draw_size(sizedist_t *sizes) {
+    double u = uniform();
+    double a, lo, hi;
+    int bin;
+
+    switch (sizes->kind) {
+    case SIZE_POWER:
+        /* Inverse CDF of a Pareto distribution truncated to [min, max] */
+        a = sizes->alpha;
+        lo = pow(sizes->min, -a);
+        hi = pow(sizes->max, -a);
+        return (int)pow(lo - u * (lo - hi), -1 / a);
+    case SIZE_BIMODAL:
+        /* Each mode spreads 25% either side of its size */
+        if (uniform() < sizes->p_large)
+            return (int)(sizes->max * (0.75 + u / 2)) + 1;
+        return (int)(sizes->min * (0.75 + u / 2)) + 1;
+    case SIZE_HIST:
+        for (bin = 0; bin < sizes->num_bins - 1 && sizes->bin_cdf[bin] <= u; bin++)
+            ;
+        return sizes->bin_size[bin];
+    }
+    return 1;
+}
+
+/*
+ * parse_sizes - parse power:ALPHA:MIN:MAX, bimodal:SMALL:LARGE:PLARGE or
+ *     hist:FILE, where FILE holds "size weight" lines
+ */
+static void parse_sizes(char *spec, sizedist_t *sizes) {
+    char path[MAXLINE];
+    FILE *fp;
+    int size;
+    double weight, total = 0;
+
+    if (sscanf(spec, "power:%lf:%lf:%lf", &sizes->alpha, &sizes->min, &sizes->max) == 3) {
+        if (sizes->alpha <= 0 || sizes->min < 1 || sizes->max <= sizes->min)
+            app_error("power needs ALPHA > 0 and 1 <= MIN < MAX");
+        sizes->kind = SIZE_POWER;
+    }
+    else if (sscanf(spec, "bimodal:%lf:%lf:%lf", &sizes->min, &sizes->max, &sizes->p_large) == 3) {
+        if (sizes->min < 1 || sizes->max < 1 || sizes->p_large < 0 || sizes->p_large > 1)
+            app_error("bimodal needs sizes of at least 1 and PLARGE within [0, 1]");
+        sizes->kind = SIZE_BIMODAL;
+    }
+    else if (sscanf(spec, "hist:%1023s", path) == 1) {
+        if ((fp = fopen(path, "r")) == NULL)
+            unix_error("Could not open the size histogram");
+        sizes->kind = SIZE_HIST;
+        sizes->num_bins = 0;
+        sizes->bin_size = NULL;
+        sizes->bin_cdf = NULL;
+        while (fscanf(fp, "%d %lf", &size, &weight) == 2) {
+            if (size < 1 || weight < 0)
+                app_error("Histogram sizes must be positive and weights non-negative");
+            sizes->bin_size = realloc(sizes->bin_size, (sizes->num_bins + 1) * sizeof(int));
+            sizes->bin_cdf = realloc(sizes->bin_cdf, (sizes->num_bins + 1) * sizeof(double));
+            if (sizes->bin_size == NULL || sizes->bin_cdf == NULL)
+                app_error("Out of memory");
+            total += weight;
+            sizes->bin_size[sizes->num_bins] = size;
+            sizes->bin_cdf[sizes->num_bins++] = total;
+        }
+        fclose(fp);
+        if (sizes->num_bins == 0 || total <= 0)
+            app_error("The size histogram is empty");
+        for (size = 0; size < sizes->num_bins; size++)
+            sizes->bin_cdf[size] /= total;
+    }
+    else
+        app_error("Unknown size distribution");
+}
+
+/*
+ * parse_lifetimes - parse exp:MEAN, lifo or fifo
+ */
+static void parse_lifetimes(char *spec, lifedist_t *lifetimes) {
+    if (sscanf(spec, "exp:%lf", &lifetimes->mean) == 1) {
+        if (lifetimes->mean <= 0)
+            app_error("exp needs a positive MEAN");
+        lifetimes->kind = LIFE_EXP;
+    }
+    else if (strcmp(spec, "lifo") == 0)
+        lifetimes->kind = LIFE_LIFO;
+    else if (strcmp(spec, "fifo") == 0)
+        lifetimes->kind = LIFE_FIFO;
+    else
+        app_error("Unknown lifetime distribution");
+}
+
+/*****************
+ * The live set
+ *****************/
+
+static void push_live(live_t block) {
+    int i = num_live++;
+
+    while (i > 0 && live[(i - 1) / 2].death > block.death) {
+        live[i] = live[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    live[i] = block;
+}
+
+static live_t pop_live(void) {
+    live_t top = live[0];
+    live_t last = live[--num_live];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < num_live) {
+        if (child + 1 < num_live && live[child + 1].death < live[child].death)
+            child++;
+        if (last.death <= live[child].death)
+            break;
+        live[i] = live[child];
+        i = child;
+    }
+    live[i] = last;
+    return top;
+}
+
+static void emit(char type, int index, int size) {
+    ops[num_ops].type = type;
+    ops[num_ops].index = index;
+    ops[num_ops++].size = size;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void) {
+    fprintf(stderr, "Usage: tracegen [-h] [-n <n>] [-s <sizes>] [-l <lifetimes>]\n");
+    fprintf(stderr, "                [-L <bytes>] [-r <frac>] [-S <seed>] [-o <file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <n>     Make n allocation or realloc requests (10000).\n");
+    fprintf(stderr, "\t-s <sizes> power:ALPHA:MIN:MAX, bimodal:SMALL:LARGE:PLARGE\n");
+    fprintf(stderr, "\t           or hist:FILE of \"size weight\" lines (power:1.5:16:4096).\n");
+    fprintf(stderr, "\t-l <life>  exp:MEAN requests, lifo or fifo (exp:100).\n");
+    fprintf(stderr, "\t-L <bytes> Free blocks while this much payload is live (1048576).\n");
+    fprintf(stderr, "\t-r <frac>  Make this fraction of requests reallocs (0).\n");
+    fprintf(stderr, "\t-S <seed>  Seed the random number generator.\n");
+    fprintf(stderr, "\t-o <file>  Write the trace to file instead of stdout.\n");
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg) {
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}